@@ -0,0 +1,360 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Native benchmark of the detector, with no Python in the loop: drives
+// DetectOne (so CLD2::ExtDetectLanguageSummaryCheckUTF8, exactly as the
+// bindings do) over the shuffle corpus and synthetic length buckets, and
+// reports MB/s, per-call latency percentiles, heap allocations per call
+// and thread scaling.
+//
+// Built and run by "python setup.py bench" (small tables) and "python
+// setup_full.py bench" (full tables); see usage() for its arguments.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "detect.h"
+#include "records.h"
+#include "workers.h"
+
+#ifdef CLD2_FULL
+static const char *kTables = "full";
+#else
+static const char *kTables = "small";
+#endif
+
+// Used when the shuffle corpus is not available, so the synthetic
+// buckets still have real text in a few scripts:
+static const char *kFallbackTexts[][2] = {
+  {"en", "The quick brown fox jumps over the lazy dog, and then it runs back into the forest to look for something to eat before night falls."},
+  {"fr", "Le renard brun rapide saute par-dessus le chien paresseux, puis il retourne dans la forêt pour chercher quelque chose à manger."},
+  {"de", "Der schnelle braune Fuchs springt über den faulen Hund und läuft dann zurück in den Wald, um vor Einbruch der Nacht etwas zu fressen."},
+  {"ru", "Быстрая коричневая лиса прыгает через ленивую собаку, а потом убегает обратно в лес, чтобы найти что-нибудь поесть до темноты."},
+  {"ja", "素早い茶色の狐は怠け者の犬を飛び越えて、夜になる前に何か食べるものを探しに森へ戻っていきます。"},
+  {"el", "Η γρήγορη καφέ αλεπού πηδάει πάνω από τον τεμπέλη σκύλο και μετά τρέχει πίσω στο δάσος για να βρει κάτι να φάει."},
+};
+
+// Every operator new in the process, CLD2's own included, so the latency
+// table can show how many heap allocations a call makes:
+static std::atomic<uint64_t> allocations(0);
+
+void *
+operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == 0) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void
+operator delete(void *p) noexcept {
+  free(p);
+}
+
+struct Workload {
+  std::string name;
+  std::vector<std::string> texts;
+  size_t totalBytes;
+};
+
+struct Config {
+  const char *name;
+  bool returnVectors;
+  bool bestEffort;
+};
+
+static const Config kConfigs[] = {
+  {"default", false, false},
+  {"returnVectors", true, false},
+  {"bestEffort", false, true},
+};
+
+static void
+usage() {
+  fprintf(stderr,
+          "Usage: cld2bench [--corpus PATH] [--threads N] [--seconds S]\n"
+          "                 [--bucketBytes N]\n\n"
+          "  --corpus PATH     CLD2's test_shuffle_1000_48_666.utf8; if it cannot\n"
+          "                    be read, only the synthetic buckets run, built from\n"
+          "                    a few built-in sentences\n"
+          "  --threads N       largest thread count for the scaling runs (default:\n"
+          "                    one per CPU)\n"
+          "  --seconds S       minimum time per measurement (default 0.5)\n"
+          "  --bucketBytes N   bytes of text per synthetic bucket (default 4 MB)\n");
+  exit(2);
+}
+
+static double
+Now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Appends the text of every "Samp lang /source/ text" line to
+// shuffle, and to that language's running text in byLang:
+static bool
+LoadCorpus(const char *path, Workload *shuffle, std::map<std::string, std::string> *byLang) {
+  MappedFile file;
+  std::vector<Record> lines;
+  std::string error;
+  if (!file.Open(path, &error) || !SplitDelimited(file.data(), file.size(), "\n", &lines, &error)) {
+    fprintf(stderr, "NOTE: %s; running synthetic buckets only\n", error.c_str());
+    return false;
+  }
+  for(unsigned int i=0;i<lines.size();i++) {
+    std::string line(lines[i].bytes, lines[i].numBytes);
+    if (line.compare(0, 5, "Samp ") != 0) {
+      continue;
+    }
+    size_t langEnd = line.find(' ', 5);
+    size_t sourceEnd = langEnd == std::string::npos ? langEnd : line.find("/ ", langEnd + 2);
+    if (sourceEnd == std::string::npos) {
+      continue;
+    }
+    // ar-Latn and ar are both Arabic:
+    std::string lang = line.substr(5, langEnd - 5);
+    lang = lang.substr(0, lang.find('-'));
+    std::string text = line.substr(sourceEnd + 2);
+    shuffle->texts.push_back(text);
+    shuffle->totalBytes += text.size();
+    std::string &all = (*byLang)[lang];
+    all += text;
+    all += ' ';
+  }
+  return true;
+}
+
+// Cuts texts of about pieceBytes each, taking turns between languages
+// so every bucket has the corpus's mix of scripts but each text is in
+// one language:
+static void
+MakeBucket(const std::map<std::string, std::string> &byLang, int pieceBytes, size_t bucketBytes, Workload *bucket) {
+  std::vector<const std::string *> streams;
+  for(std::map<std::string, std::string>::const_iterator it=byLang.begin();it!=byLang.end();++it) {
+    streams.push_back(&it->second);
+  }
+  std::vector<size_t> offsets(streams.size(), 0);
+  for(size_t k=0;bucket->totalBytes<bucketBytes;k++) {
+    int which = (int) (k % streams.size());
+    const std::string &stream = *streams[which];
+    std::string text;
+    while ((int) text.size() < pieceBytes) {
+      size_t take = std::min(stream.size() - offsets[which], (size_t) pieceBytes - text.size());
+      text.append(stream, offsets[which], take);
+      offsets[which] += take;
+      if (offsets[which] == stream.size()) {
+        offsets[which] = 0;
+      }
+    }
+    text.resize(FindPieceEnd(text.data(), (int) text.size()));
+    bucket->totalBytes += text.size();
+    bucket->texts.push_back(text);
+  }
+}
+
+static DetectOptions
+MakeOptions(const Config &config) {
+  DetectOptions opts;
+  memset(&opts.cldHints, 0, sizeof(opts.cldHints));
+  opts.cldHints.language_hint = CLD2::UNKNOWN_LANGUAGE;
+  opts.cldHints.encoding_hint = CLD2::UNKNOWN_ENCODING;
+  opts.isPlainText = true;
+  opts.returnVectors = config.returnVectors;
+  opts.columnarVectors = false;
+  opts.flags = config.bestEffort ? CLD2::kCLDFlagBestEffort : 0;
+  opts.maxBytes = 0;
+  opts.detect = 0;
+  opts.invalidUTF8 = kInvalidUTF8Error;
+  opts.sourceEncoding = CLD2::UTF8;
+  opts.restrictLanguages = false;
+  opts.optionsHash = 0;
+  opts.trace = 0;
+  return opts;
+}
+
+static double
+Percentile(const std::vector<double> &sorted, double p) {
+  size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+// One thread, timing every call.  Allocations are counted from the
+// second pass over the texts on, once per-thread scratch has grown:
+static void
+RunLatency(const Workload &w, const Config &config, double minSeconds) {
+  DetectOptions opts = MakeOptions(config);
+  std::vector<double> latencies;
+  latencies.reserve(w.texts.size());
+  double bytes = 0;
+  double busy = 0;
+  uint64_t allocs = 0;
+  uint64_t allocCalls = 0;
+  double t0 = Now();
+  for(int pass=0;;pass++) {
+    for(unsigned int i=0;i<w.texts.size();i++) {
+      double start = Now();
+      uint64_t allocsBefore = allocations.load(std::memory_order_relaxed);
+      {
+        // As the bindings do, a fresh result per call:
+        ScratchResult r;
+        DetectOne(w.texts[i].data(), (int) w.texts[i].size(), opts, &r);
+      }
+      uint64_t allocsAfter = allocations.load(std::memory_order_relaxed);
+      double elapsed = Now() - start;
+      latencies.push_back(elapsed);
+      busy += elapsed;
+      if (pass > 0) {
+        allocs += allocsAfter - allocsBefore;
+        allocCalls++;
+      }
+    }
+    bytes += w.totalBytes;
+    if (pass > 0 && Now() - t0 >= minSeconds) {
+      break;
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-10s %-6s %-14s %9zu %9.2f %9.1f %9.1f %9.1f %9.1f %9.1f %9.2f\n",
+         w.name.c_str(), kTables, config.name, latencies.size(),
+         bytes / busy / 1024 / 1024,
+         1e6 * Percentile(latencies, 0.5),
+         1e6 * Percentile(latencies, 0.9),
+         1e6 * Percentile(latencies, 0.99),
+         1e6 * Percentile(latencies, 0.999),
+         1e6 * latencies.back(),
+         (double) allocs / allocCalls);
+  fflush(stdout);
+}
+
+// Every text detected across threadCount threads (the calling thread
+// included), repeated until minSeconds pass; returns MB/s:
+static double
+RunThroughput(const Workload &w, const Config &config, int threadCount, double minSeconds) {
+  DetectOptions opts = MakeOptions(config);
+  int count = (int) w.texts.size();
+  double bytes = 0;
+  double t0 = Now();
+  double elapsed;
+  while (true) {
+    GetWorkerPool()->ParallelFor(count, threadCount, [&](int i) {
+        ScratchResult r;
+        DetectOne(w.texts[i].data(), (int) w.texts[i].size(), opts, &r);
+      });
+    bytes += w.totalBytes;
+    elapsed = Now() - t0;
+    if (elapsed >= minSeconds) {
+      break;
+    }
+  }
+  return bytes / elapsed / 1024 / 1024;
+}
+
+int
+main(int argc, char **argv) {
+  const char *corpusPath = "../cld2/internal/test_shuffle_1000_48_666.utf8";
+  int maxThreads = (int) std::thread::hardware_concurrency();
+  double minSeconds = 0.5;
+  size_t bucketBytes = 4 * 1024 * 1024;
+
+  for(int i=1;i<argc;i++) {
+    if (i + 1 == argc) {
+      usage();
+    }
+    if (strcmp(argv[i], "--corpus") == 0) {
+      corpusPath = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      maxThreads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0) {
+      minSeconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--bucketBytes") == 0) {
+      bucketBytes = (size_t) atol(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (maxThreads < 1 || minSeconds <= 0 || bucketBytes == 0) {
+    usage();
+  }
+
+  std::vector<Workload> workloads;
+  Workload shuffle;
+  shuffle.name = "shuffle";
+  shuffle.totalBytes = 0;
+  std::map<std::string, std::string> byLang;
+  if (LoadCorpus(corpusPath, &shuffle, &byLang) && !shuffle.texts.empty()) {
+    workloads.push_back(shuffle);
+  } else {
+    byLang.clear();
+    for(unsigned int i=0;i<sizeof(kFallbackTexts)/sizeof(kFallbackTexts[0]);i++) {
+      byLang[kFallbackTexts[i][0]] = std::string(kFallbackTexts[i][1]) + " ";
+    }
+  }
+
+  // Roughly a tweet, a paragraph and a whole page:
+  static const struct {
+    const char *name;
+    int pieceBytes;
+  } kBuckets[] = {{"tweet", 140}, {"paragraph", 1024}, {"page", 32768}};
+  for(unsigned int i=0;i<sizeof(kBuckets)/sizeof(kBuckets[0]);i++) {
+    Workload bucket;
+    bucket.name = kBuckets[i].name;
+    bucket.totalBytes = 0;
+    MakeBucket(byLang, kBuckets[i].pieceBytes, bucketBytes, &bucket);
+    workloads.push_back(bucket);
+  }
+
+  printf("Latency, one thread (MB/s counts time inside DetectOne only; latencies in usec;\n"
+         "allocs is operator new calls per call, CLD2's own included):\n\n");
+  printf("%-10s %-6s %-14s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+         "workload", "tables", "config", "calls", "MB/s", "p50", "p90", "p99", "p99.9", "max", "allocs");
+  for(unsigned int i=0;i<workloads.size();i++) {
+    for(unsigned int j=0;j<sizeof(kConfigs)/sizeof(kConfigs[0]);j++) {
+      RunLatency(workloads[i], kConfigs[j], minSeconds);
+    }
+  }
+
+  std::vector<int> threadCounts;
+  for(int t=1;t<maxThreads;t*=2) {
+    threadCounts.push_back(t);
+  }
+  threadCounts.push_back(maxThreads);
+
+  printf("\nThread scaling (MB/s, and speedup over one thread):\n\n");
+  printf("%-10s %-6s %-14s %9s %9s %9s\n", "workload", "tables", "config", "threads", "MB/s", "speedup");
+  for(unsigned int i=0;i<workloads.size();i++) {
+    for(unsigned int j=0;j<sizeof(kConfigs)/sizeof(kConfigs[0]);j++) {
+      double base = 0;
+      for(unsigned int k=0;k<threadCounts.size();k++) {
+        double mbPerSec = RunThroughput(workloads[i], kConfigs[j], threadCounts[k], minSeconds);
+        if (k == 0) {
+          base = mbPerSec;
+        }
+        printf("%-10s %-6s %-14s %9d %9.2f %8.2fx\n",
+               workloads[i].name.c_str(), kTables, kConfigs[j].name,
+               threadCounts[k], mbPerSec, mbPerSec / base);
+        fflush(stdout);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,167 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+#include "cache.h"
+
+static const uint64_t kMul1 = 0x9E3779B97F4A7C15ULL;
+static const uint64_t kMul2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t
+Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= kMul2;
+  h ^= h >> 29;
+  return h;
+}
+
+uint64_t HashBytes(const char *bytes, size_t numBytes, uint64_t seed) {
+  uint64_t h = seed ^ (numBytes * kMul1);
+  size_t i = 0;
+  for(;i+8<=numBytes;i+=8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h = (h ^ Mix(word * kMul1)) * kMul2;
+  }
+  if (i < numBytes) {
+    uint64_t word = 0;
+    memcpy(&word, bytes + i, numBytes - i);
+    h = (h ^ Mix(word * kMul1)) * kMul2;
+  }
+  return Mix(h);
+}
+
+static uint64_t
+HashString(const char *s, uint64_t seed) {
+  return s == 0 ? Mix(seed + 1) : HashBytes(s, strlen(s), seed);
+}
+
+uint64_t HashDetectOptions(const DetectOptions &opts) {
+  // Every field that can change what DetectOne returns:
+  int64_t fields[] = {
+    opts.isPlainText,
+    opts.returnVectors,
+    opts.flags,
+    opts.maxBytes,
+    opts.invalidUTF8,
+    opts.sourceEncoding,
+    opts.cldHints.language_hint,
+    opts.cldHints.encoding_hint,
+    (int64_t) (intptr_t) opts.detect,
+    opts.restrictLanguages,
+  };
+  uint64_t h = HashBytes((const char *) fields, sizeof(fields), 0);
+  if (opts.restrictLanguages) {
+    h = HashBytes((const char *) opts.languages.bits, sizeof(opts.languages.bits), h);
+  }
+  h = HashString(opts.cldHints.tld_hint, h);
+  h = HashString(opts.cldHints.content_language_hint, h);
+  return h == 0 ? 1 : h;
+}
+
+ResultCache::ResultCache() : maxEntries(0), maxBytes(-1), maxEntriesPerShard(0) {
+  for(int i=0;i<kNumShards;i++) {
+    shards[i].hits = 0;
+    shards[i].misses = 0;
+    shards[i].evictions = 0;
+  }
+}
+
+void ResultCache::Configure(int maxEntries, int maxBytes) {
+  for(int i=0;i<kNumShards;i++) {
+    shards[i].mu.lock();
+  }
+  for(int i=0;i<kNumShards;i++) {
+    shards[i].lru.clear();
+    shards[i].index.clear();
+  }
+  this->maxEntries = maxEntries;
+  // In 64 bits, since rounding INT_MAX up would overflow:
+  this->maxEntriesPerShard = (int) (((int64_t) maxEntries + kNumShards - 1) / kNumShards);
+  this->maxBytes.store(maxEntries > 0 ? maxBytes : -1);
+  for(int i=0;i<kNumShards;i++) {
+    shards[i].mu.unlock();
+  }
+}
+
+bool ResultCache::Lookup(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  uint64_t hash = HashBytes(bytes, numBytes, opts.optionsHash);
+  Shard &shard = ShardFor(hash);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  auto it = shard.index.find(hash);
+  if (it == shard.index.end() || it->second->optionsHash != opts.optionsHash ||
+      it->second->bytes.size() != (size_t) numBytes ||
+      memcmp(it->second->bytes.data(), bytes, numBytes) != 0) {
+    shard.misses++;
+    return false;
+  }
+  shard.hits++;
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  *result = it->second->result;
+  return true;
+}
+
+void ResultCache::Insert(const char *bytes, int numBytes, const DetectOptions &opts, const DetectResult &result) {
+  uint64_t hash = HashBytes(bytes, numBytes, opts.optionsHash);
+  Shard &shard = ShardFor(hash);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  if (maxEntriesPerShard == 0) {
+    // Disabled while this input was being detected:
+    return;
+  }
+  // Entries are moved to the front and overwritten rather than freed,
+  // so a full cache reuses their list nodes and buffers:
+  auto it = shard.index.find(hash);
+  if (it != shard.index.end()) {
+    // Another thread detected it first, or a hash collision; keep the
+    // newest:
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  } else if ((int) shard.lru.size() >= maxEntriesPerShard) {
+    shard.index.erase(shard.lru.back().hash);
+    shard.lru.splice(shard.lru.begin(), shard.lru, --shard.lru.end());
+    shard.evictions++;
+  } else {
+    shard.lru.push_front(Entry());
+  }
+  Entry &entry = shard.lru.front();
+  entry.hash = hash;
+  entry.optionsHash = opts.optionsHash;
+  entry.bytes.assign(bytes, numBytes);
+  entry.result = result;
+  shard.index[hash] = shard.lru.begin();
+}
+
+void ResultCache::GetStats(CacheStats *stats) {
+  stats->hits = 0;
+  stats->misses = 0;
+  stats->evictions = 0;
+  stats->entries = 0;
+  for(int i=0;i<kNumShards;i++) {
+    std::lock_guard<std::mutex> lock(shards[i].mu);
+    stats->hits += shards[i].hits;
+    stats->misses += shards[i].misses;
+    stats->evictions += shards[i].evictions;
+    stats->entries += shards[i].lru.size();
+    if (i == 0) {
+      stats->maxEntries = maxEntries;
+      stats->maxBytes = maxEntries > 0 ? maxBytes.load() : 0;
+    }
+  }
+}
+
+ResultCache *GetResultCache() {
+  // Leaked, like the worker pool, so it outlives any thread using it:
+  static ResultCache *cache = new ResultCache();
+  return cache;
+}
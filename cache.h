@@ -0,0 +1,104 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Opt-in, process-wide cache of results for short inputs, so repeated
+// strings (titles, labels, boilerplate) skip CLD2 entirely.  Entries
+// are spread over lock-striped shards, each an LRU list bounded to its
+// share of the entries.
+
+#ifndef PYCLD_CACHE_H_
+#define PYCLD_CACHE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "detect.h"
+
+// Fast 64-bit hash of bytes[0..numBytes), mixed with seed:
+uint64_t HashBytes(const char *bytes, size_t numBytes, uint64_t seed);
+
+// Hash of everything in opts that can change a result; never 0, since
+// 0 marks options that must not be cached:
+uint64_t HashDetectOptions(const DetectOptions &opts);
+
+struct CacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t entries;
+  int maxEntries;
+  int maxBytes;
+};
+
+class ResultCache {
+ public:
+  ResultCache();
+
+  // Drops every entry and resizes the cache; maxEntries 0 disables it.
+  // Inputs longer than maxBytes are never cached.
+  void Configure(int maxEntries, int maxBytes);
+
+  // True if bytes may be cached with these options:
+  bool Cacheable(int numBytes, const DetectOptions &opts) const {
+    return numBytes <= maxBytes.load(std::memory_order_relaxed) && opts.optionsHash != 0;
+  }
+
+  // Copies the cached result for bytes into *result and returns true,
+  // or returns false on a miss.
+  bool Lookup(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+
+  void Insert(const char *bytes, int numBytes, const DetectOptions &opts, const DetectResult &result);
+
+  void GetStats(CacheStats *stats);
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    uint64_t optionsHash;
+    std::string bytes;
+    DetectResult result;
+  };
+
+  struct Shard {
+    std::mutex mu;
+    // Most recently used first:
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  static const int kNumShards = 64;
+
+  Shard &ShardFor(uint64_t hash) {
+    return shards[hash % kNumShards];
+  }
+
+  Shard shards[kNumShards];
+  // Written only by Configure, with every shard locked; maxBytes is -1
+  // while the cache is disabled, so nothing is cacheable:
+  int maxEntries;
+  std::atomic<int> maxBytes;
+  int maxEntriesPerShard;
+};
+
+// The process-wide cache, created disabled on first use:
+ResultCache *GetResultCache();
+
+#endif  // PYCLD_CACHE_H_
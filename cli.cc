@@ -0,0 +1,426 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Command-line detector for bulk pipelines, with no Python in the loop:
+// reads records (lines, by default) from files or stdin, detects them
+// with DetectOne on the worker pool and writes one TSV or JSON line per
+// record, in input order.
+//
+// Built by "python setup.py cli" (small tables) and "python
+// setup_full.py cli" (full tables); see usage() for its arguments.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "cache.h"
+#include "detect.h"
+#include "transcode.h"
+#include "workers.h"
+
+// impl is in ./encodings.cc:
+CLD2::Encoding EncodingFromName(const char *name);
+
+#ifdef CLD2_FULL
+static const char *kProgram = "cld2fulldetect";
+#else
+static const char *kProgram = "cld2detect";
+#endif
+
+// Records are read and detected in batches of at most about this many
+// bytes; a batch is cut short when no more input is ready, so a slow
+// pipeline still sees each line's result promptly.  Each batch's output
+// is written before the next is read:
+static const size_t kBatchBytes = 4 * 1024 * 1024;
+
+// Records are handed to threads in blocks this big, so tiny records do
+// not all contend on the shared counter:
+static const int kRecordsPerTask = 256;
+
+static void
+usage() {
+  fprintf(stderr,
+          "Usage: %s [options] [FILE ...]\n\n"
+          "Detects the language of every record of each FILE (or of stdin, if\n"
+          "there is none or FILE is -) and writes one line per record, in order.\n\n"
+          "  --format tsv|jsonl    tsv (the default): language code, percent,\n"
+          "                        score and reliable (1, 0, or -1 for invalid\n"
+          "                        UTF-8), tab-separated; jsonl: one object per\n"
+          "                        record with those fields, reliable as a bool,\n"
+          "                        plus \"error\" for invalid UTF-8\n"
+          "  --zero                records end with NUL instead of newline\n"
+          "  --threads N           detection threads (default: one per CPU)\n"
+          "  --html                the records are HTML, not plain text\n"
+          "  --encoding NAME       the records are in this encoding (one of\n"
+          "                        cld2.ENCODINGS), not UTF-8, and are converted\n"
+          "                        natively; a newline or NUL byte must still end\n"
+          "                        each record\n"
+          "  --hintTopLevelDomain TLD\n"
+          "  --hintLanguage NAME\n"
+          "  --hintLanguageHTTPHeaders LANGS\n"
+          "  --hintEncoding NAME\n"
+          "  --bestEffort\n"
+          "  --maxBytes N\n"
+          "  --invalidUTF8 error|replace|skip\n"
+          "  --languages CODE,CODE,...\n"
+          "  --cache N             cache results of up to N short records\n"
+          "  --debugScoreAsQuads, --debugHTML, --debugCR, --debugVerbose,\n"
+          "  --debugQuiet, --debugEcho\n"
+          "  --                    ends the options: every later argument is a\n"
+          "                        FILE, even one starting with --\n\n"
+          "The options mean what detect()'s keyword arguments of the same names\n"
+          "do; see help(cld2.detect).  Exits with status 1 if a file cannot be\n"
+          "read or written, and 2 on bad arguments.\n",
+          kProgram);
+  exit(2);
+}
+
+static void
+fail(const char *message, const char *arg) {
+  fprintf(stderr, "%s: %s%s\n", kProgram, message, arg);
+  exit(2);
+}
+
+// The value of a numeric option, which must be a whole number from 0
+// to INT_MAX; anything else (atoi would take "-3" or "4x") fails:
+static int
+ParseCount(const char *option, const char *value) {
+  char *end;
+  errno = 0;
+  long n = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || errno != 0 || n < 0 || n > INT_MAX) {
+    fail((std::string(option) + " must be a whole number from 0 to " + std::to_string(INT_MAX) + ", not ").c_str(), value);
+  }
+  return (int) n;
+}
+
+struct Output {
+  bool jsonl;
+};
+
+// Appends one output line for a record to *out:
+static void
+FormatResult(const Output &output, const DetectResult &r, int numBytes, std::string *out) {
+  char line[160];
+  int n;
+  bool invalid = r.validPrefixBytes < numBytes;
+  const char *code = invalid ? "un" : CLD2::LanguageCode(r.language3[0]);
+  int percent = invalid ? 0 : r.percent3[0];
+  double score = invalid ? 0.0 : r.normalized_score3[0];
+  if (output.jsonl) {
+    if (invalid && r.validPrefixBytes == kInputTooLarge) {
+      n = snprintf(line, sizeof(line),
+                   "{\"language\":\"un\",\"percent\":0,\"score\":0.0,\"reliable\":false,"
+                   "\"error\":\"too large to detect\"}\n");
+    } else if (invalid) {
+      n = snprintf(line, sizeof(line),
+                   "{\"language\":\"un\",\"percent\":0,\"score\":0.0,\"reliable\":false,"
+                   "\"error\":\"invalid UTF-8 around byte %d\"}\n", r.validPrefixBytes);
+    } else {
+      n = snprintf(line, sizeof(line), "{\"language\":\"%s\",\"percent\":%d,\"score\":%.1f,\"reliable\":%s}\n",
+                   code, percent, score, r.isReliable ? "true" : "false");
+    }
+  } else {
+    n = snprintf(line, sizeof(line), "%s\t%d\t%.1f\t%d\n",
+                 code, percent, score, invalid ? -1 : r.isReliable ? 1 : 0);
+  }
+  out->append(line, std::min(n, (int) sizeof(line) - 1));
+}
+
+// Detects every record in records and writes their lines to stdout, in
+// order; returns false if writing failed:
+static bool
+DetectBatch(const std::vector<std::pair<const char *, int> > &records, const DetectOptions &opts,
+            int threads, const Output &output) {
+  int count = (int) records.size();
+  int numTasks = (count + kRecordsPerTask - 1) / kRecordsPerTask;
+  std::vector<std::string> outs(numTasks);
+  GetWorkerPool()->ParallelFor(numTasks, threads, [&](int task) {
+      ScratchResult r;
+      int end = std::min(count, (task + 1) * kRecordsPerTask);
+      for(int i=task*kRecordsPerTask;i<end;i++) {
+        DetectOne(records[i].first, records[i].second, opts, &r);
+        FormatResult(output, r, records[i].second, &outs[task]);
+      }
+    });
+  for(int i=0;i<numTasks;i++) {
+    if (fwrite(outs[i].data(), 1, outs[i].size(), stdout) != outs[i].size()) {
+      return false;
+    }
+  }
+  return fflush(stdout) == 0;
+}
+
+// Appends to *buffer what can be read from fd right now, blocking only
+// until there is some input, up to a batch in all.  Returns -1 on
+// error, 0 at end of input and 1 otherwise:
+static int
+ReadSome(int fd, std::string *buffer) {
+  size_t start = buffer->size();
+  // After the partial record carried over from the last batch, which
+  // may itself be bigger than a batch:
+  size_t limit = std::max(kBatchBytes, 2 * start);
+  buffer->resize(limit);
+  size_t upto = start;
+  int ret = 1;
+  while (upto < limit) {
+    if (upto > start) {
+      struct pollfd p = {fd, POLLIN, 0};
+      if (poll(&p, 1, 0) <= 0) {
+        break;
+      }
+    }
+    ssize_t got = read(fd, &(*buffer)[upto], limit - upto);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      ret = got < 0 ? -1 : upto > start ? 1 : 0;
+      break;
+    }
+    upto += got;
+  }
+  buffer->resize(upto);
+  return ret;
+}
+
+// Reads fd to the end, detecting it batch by batch; returns false, with
+// a message on stderr, if reading or writing failed:
+static bool
+DetectStream(int fd, const char *name, char delimiter, const DetectOptions &opts,
+             int threads, const Output &output) {
+  std::string buffer;
+  std::vector<std::pair<const char *, int> > records;
+  bool eof = false;
+  while (!eof) {
+    int ret = ReadSome(fd, &buffer);
+    if (ret < 0) {
+      fprintf(stderr, "%s: cannot read %s: %s\n", kProgram, name, strerror(errno));
+      return false;
+    }
+    eof = ret == 0;
+
+    // Complete records, plus whatever is left at EOF:
+    records.clear();
+    size_t recordStart = 0;
+    for(;;) {
+      const char *end = (const char *) memchr(buffer.data() + recordStart, delimiter, buffer.size() - recordStart);
+      size_t recordEnd = end == 0 ? buffer.size() : end - buffer.data();
+      if (end == 0 && (!eof || recordStart == buffer.size())) {
+        break;
+      }
+      if (recordEnd - recordStart > (size_t) INT_MAX) {
+        fprintf(stderr, "%s: record in %s is too large (more than 2 GB)\n", kProgram, name);
+        return false;
+      }
+      records.push_back(std::make_pair(buffer.data() + recordStart, (int) (recordEnd - recordStart)));
+      if (end == 0) {
+        recordStart = buffer.size();
+        break;
+      }
+      recordStart = recordEnd + 1;
+    }
+
+    if (!records.empty() && !DetectBatch(records, opts, threads, output)) {
+      fprintf(stderr, "%s: cannot write output: %s\n", kProgram, strerror(errno));
+      return false;
+    }
+    buffer.erase(0, recordStart);
+  }
+  return true;
+}
+
+int
+main(int argc, char **argv) {
+  DetectOptions opts;
+  memset(&opts.cldHints, 0, sizeof(opts.cldHints));
+  opts.cldHints.language_hint = CLD2::UNKNOWN_LANGUAGE;
+  opts.cldHints.encoding_hint = CLD2::UNKNOWN_ENCODING;
+  opts.isPlainText = true;
+  opts.returnVectors = false;
+  opts.columnarVectors = false;
+  opts.flags = 0;
+  opts.maxBytes = 0;
+  opts.detect = 0;
+  opts.invalidUTF8 = kInvalidUTF8Error;
+  opts.sourceEncoding = CLD2::UTF8;
+  opts.restrictLanguages = false;
+
+  Output output;
+  output.jsonl = false;
+  char delimiter = '\n';
+  int threads = 0;
+  int cacheEntries = 0;
+  std::vector<const char *> paths;
+
+  static const struct {
+    const char *name;
+    int flag;
+  } kFlags[] = {
+    {"--bestEffort", CLD2::kCLDFlagBestEffort},
+    {"--debugScoreAsQuads", CLD2::kCLDFlagScoreAsQuads},
+    {"--debugHTML", CLD2::kCLDFlagHtml},
+    {"--debugCR", CLD2::kCLDFlagCr},
+    {"--debugVerbose", CLD2::kCLDFlagVerbose},
+    {"--debugQuiet", CLD2::kCLDFlagQuiet},
+    {"--debugEcho", CLD2::kCLDFlagEcho},
+  };
+
+  bool endOfOptions = false;
+  for(int i=1;i<argc;i++) {
+    const char *arg = argv[i];
+    if (!endOfOptions && (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)) {
+      usage();
+    }
+    if (endOfOptions || strncmp(arg, "--", 2) != 0) {
+      paths.push_back(arg);
+      continue;
+    }
+    if (strcmp(arg, "--") == 0) {
+      endOfOptions = true;
+      continue;
+    }
+    bool isFlag = false;
+    for(unsigned int f=0;f<sizeof(kFlags)/sizeof(kFlags[0]);f++) {
+      if (strcmp(arg, kFlags[f].name) == 0) {
+        opts.flags |= kFlags[f].flag;
+        isFlag = true;
+      }
+    }
+    if (isFlag) {
+      continue;
+    }
+    if (strcmp(arg, "--html") == 0) {
+      opts.isPlainText = false;
+      continue;
+    }
+    if (strcmp(arg, "--zero") == 0) {
+      delimiter = '\0';
+      continue;
+    }
+
+    // Every other option takes a value:
+    if (i + 1 == argc) {
+      usage();
+    }
+    const char *value = argv[++i];
+    if (strcmp(arg, "--format") == 0) {
+      if (strcmp(value, "tsv") != 0 && strcmp(value, "jsonl") != 0) {
+        fail("--format must be tsv or jsonl, not ", value);
+      }
+      output.jsonl = strcmp(value, "jsonl") == 0;
+    } else if (strcmp(arg, "--threads") == 0) {
+      threads = ParseCount(arg, value);
+    } else if (strcmp(arg, "--hintTopLevelDomain") == 0) {
+      opts.cldHints.tld_hint = value;
+    } else if (strcmp(arg, "--hintLanguage") == 0) {
+      opts.cldHints.language_hint = LanguageFromName(value);
+      if (opts.cldHints.language_hint == CLD2::UNKNOWN_LANGUAGE) {
+        fail("unrecognized language hint name: ", value);
+      }
+    } else if (strcmp(arg, "--hintLanguageHTTPHeaders") == 0) {
+      opts.cldHints.content_language_hint = value;
+    } else if (strcmp(arg, "--hintEncoding") == 0) {
+      opts.cldHints.encoding_hint = EncodingFromName(value);
+      if (opts.cldHints.encoding_hint == CLD2::UNKNOWN_ENCODING) {
+        fail("unrecognized encoding hint: ", value);
+      }
+    } else if (strcmp(arg, "--encoding") == 0) {
+      opts.sourceEncoding = EncodingFromName(value);
+      std::string error;
+      if (opts.sourceEncoding == CLD2::UNKNOWN_ENCODING) {
+        fail("unrecognized encoding: ", value);
+      } else if (!CanTranscode(opts.sourceEncoding, &error)) {
+        fail((error + ": ").c_str(), value);
+      }
+    } else if (strcmp(arg, "--maxBytes") == 0) {
+      opts.maxBytes = ParseCount(arg, value);
+    } else if (strcmp(arg, "--invalidUTF8") == 0) {
+      if (strcmp(value, "error") == 0) {
+        opts.invalidUTF8 = kInvalidUTF8Error;
+      } else if (strcmp(value, "replace") == 0) {
+        opts.invalidUTF8 = kInvalidUTF8Replace;
+      } else if (strcmp(value, "skip") == 0) {
+        opts.invalidUTF8 = kInvalidUTF8Skip;
+      } else {
+        fail("--invalidUTF8 must be error, replace or skip, not ", value);
+      }
+    } else if (strcmp(arg, "--languages") == 0) {
+      opts.restrictLanguages = true;
+      memset(opts.languages.bits, 0, sizeof(opts.languages.bits));
+      std::string list(value);
+      size_t start = 0;
+      while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+          end = list.size();
+        }
+        std::string name = list.substr(start, end - start);
+        CLD2::Language lang = LanguageFromName(name.c_str());
+        if (lang == CLD2::UNKNOWN_LANGUAGE) {
+          fail("unrecognized language name in --languages: ", name.c_str());
+        }
+        opts.languages.Add(lang);
+        start = end + 1;
+      }
+    } else if (strcmp(arg, "--cache") == 0) {
+      cacheEntries = ParseCount(arg, value);
+    } else {
+      fail("unknown option ", arg);
+    }
+  }
+
+  // As in the bindings, the source encoding is also the encoding hint
+  // unless one was given:
+  if (opts.cldHints.encoding_hint == CLD2::UNKNOWN_ENCODING && NeedsTranscoding(opts.sourceEncoding)) {
+    opts.cldHints.encoding_hint = opts.sourceEncoding;
+  }
+
+  // As in the bindings, calls with a debug flag are never cached:
+  const int debugFlags = CLD2::kCLDFlagHtml | CLD2::kCLDFlagCr | CLD2::kCLDFlagVerbose |
+    CLD2::kCLDFlagQuiet | CLD2::kCLDFlagEcho;
+  opts.optionsHash = (opts.flags & debugFlags) != 0 ? 0 : HashDetectOptions(opts);
+  opts.trace = 0;
+  if (cacheEntries > 0) {
+    GetResultCache()->Configure(cacheEntries, 256);
+  }
+
+  if (paths.empty()) {
+    paths.push_back("-");
+  }
+  int status = 0;
+  for(unsigned int i=0;i<paths.size();i++) {
+    bool isStdin = strcmp(paths[i], "-") == 0;
+    int fd = isStdin ? 0 : open(paths[i], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "%s: cannot open %s: %s\n", kProgram, paths[i], strerror(errno));
+      status = 1;
+      continue;
+    }
+    if (!DetectStream(fd, isStdin ? "stdin" : paths[i], delimiter, opts, threads, output)) {
+      status = 1;
+    }
+    if (!isStdin) {
+      close(fd);
+    }
+  }
+  return status;
+}
@@ -0,0 +1,630 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include "cache.h"
+#include "detect.h"
+#include "stats.h"
+#include "trace.h"
+#include "transcode.h"
+#include "utf8.h"
+#include "workers.h"
+
+// How far back from the end of a piece FindPieceEnd looks for
+// whitespace before settling for a UTF-8 boundary:
+static const int kMaxWhitespaceBackoff = 4096;
+
+// Below this a sampled text is scored as one head window rather than
+// three:
+static const int kMinSampleWindowBytes = 1024;
+
+// Head, tail and middle:
+static const int kSampledWindows = 3;
+
+// DetectParallel aims for this many pieces per thread, so threads that
+// finish early can take more, within these piece sizes:
+static const int kParallelPiecesPerThread = 4;
+static const int kMinParallelPieceBytes = 64 * 1024;
+static const int kMaxParallelPieceBytes = 1024 * 1024;
+
+// How many times DetectScrubbed re-scrubs text that CLD2 still rejects:
+static const int kMaxScrubPasses = 8;
+
+// Converted or scrubbed text bigger than this is not kept for reuse by
+// the next call, so one huge document does not pin its size per thread:
+static const size_t kMaxKeptTextBytes = 4 * 1024 * 1024;
+
+// Nor are spare chunk vectors longer than this; see ScratchResult:
+static const size_t kMaxKeptChunks = 64 * 1024;
+
+// The chunk vector ScratchResult lends out, when not lent:
+static thread_local CLD2::ResultChunkVector spareChunks;
+
+ScratchResult::ScratchResult() {
+  resultChunkVector.swap(spareChunks);
+}
+
+ScratchResult::~ScratchResult() {
+  if (resultChunkVector.capacity() > spareChunks.capacity() &&
+      resultChunkVector.capacity() <= kMaxKeptChunks) {
+    resultChunkVector.clear();
+    resultChunkVector.swap(spareChunks);
+  }
+}
+
+static void DetectUncached(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+static void DetectTranscoded(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+static void DetectValid(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+static void DetectScrubbed(const char *bytes, int numBytes, int validPrefixBytes, const DetectOptions &opts, DetectResult *result);
+
+void DetectOne(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  ResultCache *cache = GetResultCache();
+  if (opts.trace == 0 && cache->Cacheable(numBytes, opts)) {
+    if (!cache->Lookup(bytes, numBytes, opts, result)) {
+      DetectUncached(bytes, numBytes, opts, result);
+      cache->Insert(bytes, numBytes, opts, *result);
+    }
+    return;
+  }
+  DetectUncached(bytes, numBytes, opts, result);
+}
+
+static void
+DetectUncached(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  if (NeedsTranscoding(opts.sourceEncoding)) {
+    DetectTranscoded(bytes, numBytes, opts, result);
+    return;
+  }
+  if (opts.maxBytes > 0 && numBytes > opts.maxBytes) {
+    DetectSampled(bytes, numBytes, opts, result);
+    return;
+  }
+  result->bytesScored = numBytes;
+  if (opts.invalidUTF8 != kInvalidUTF8Error) {
+    int validPrefixBytes = ValidUTF8Prefix(bytes, numBytes);
+    if (validPrefixBytes < numBytes) {
+      DetectScrubbed(bytes, numBytes, validPrefixBytes, opts, result);
+      return;
+    }
+  }
+  DetectValid(bytes, numBytes, opts, result);
+}
+
+// Converts bytes to UTF-8 in *text and sets *utf8Opts to opts for
+// detecting it.  Returns false, with result->validPrefixBytes set, if
+// bytes are not valid in opts.sourceEncoding and opts.invalidUTF8 is
+// kInvalidUTF8Error, or if the UTF-8 would be too large to detect:
+static bool
+Transcode(const char *bytes, int numBytes, const DetectOptions &opts,
+          std::string *text, DetectOptions *utf8Opts, DetectResult *result) {
+  int badOffset;
+  if (!TranscodeToUTF8(opts.sourceEncoding, bytes, numBytes, opts.invalidUTF8 == kInvalidUTF8Error,
+                       opts.invalidUTF8 == kInvalidUTF8Replace, text, &badOffset)) {
+    result->validPrefixBytes = badOffset < 0 ? kInputTooLarge : badOffset;
+    result->bytesScored = 0;
+    return false;
+  }
+  *utf8Opts = opts;
+  utf8Opts->sourceEncoding = CLD2::UTF8;
+  if (utf8Opts->invalidUTF8 == kInvalidUTF8Error) {
+    utf8Opts->invalidUTF8 = kInvalidUTF8Skip;
+  }
+  return true;
+}
+
+static void
+DetectTranscoded(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  static thread_local std::string text;
+  DetectOptions utf8Opts;
+  if (Transcode(bytes, numBytes, opts, &text, &utf8Opts, result)) {
+    DetectUncached(text.data(), (int) text.size(), utf8Opts, result);
+    result->validPrefixBytes = numBytes;
+  }
+  if (text.capacity() > kMaxKeptTextBytes) {
+    std::string().swap(text);
+  }
+}
+
+// Calls CLD2, which checks the input is valid UTF-8 before detecting:
+static void
+DetectValid(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  DetectFunction detect = opts.detect != 0 ? opts.detect : CLD2::ExtDetectLanguageSummaryCheckUTF8;
+  // A trace needs the chunks even if the caller does not:
+  bool wantVectors = opts.returnVectors || opts.trace != 0;
+  uint64_t start = opts.trace != 0 ? StatsNow() : 0;
+  detect(bytes, numBytes,
+         opts.isPlainText,
+         &opts.cldHints,
+         opts.flags,
+         result->language3,
+         result->percent3,
+         result->normalized_score3,
+         wantVectors ? &result->resultChunkVector : 0,
+         &result->textBytesFound,
+         &result->isReliable,
+         &result->validPrefixBytes);
+  if (opts.trace != 0) {
+    opts.trace->AddPass(bytes, numBytes, opts, result->resultChunkVector, StatsNow() - start);
+    if (!opts.returnVectors) {
+      result->resultChunkVector.clear();
+    }
+  }
+  if (opts.restrictLanguages) {
+    RestrictLanguages(opts.languages, result);
+  }
+}
+
+static void
+DetectScrubbed(const char *bytes, int numBytes, int validPrefixBytes, const DetectOptions &opts, DetectResult *result) {
+  bool replace = opts.invalidUTF8 == kInvalidUTF8Replace;
+  static thread_local std::string text;
+  ScrubUTF8(bytes, numBytes, validPrefixBytes, replace, &text);
+
+  // In case CLD2 still rejects some character ScrubUTF8 let through,
+  // scrub that one too, a few times at most:
+  bool valid = false;
+  for(int pass=0;;pass++) {
+    if (text.size() > (size_t) INT_MAX) {
+      break;
+    }
+    DetectValid(text.data(), (int) text.size(), opts, result);
+    int bad = result->validPrefixBytes;
+    if (bad >= (int) text.size()) {
+      valid = true;
+      break;
+    }
+    if (pass == kMaxScrubPasses) {
+      break;
+    }
+    int badLength = 1;
+    while (bad + badLength < (int) text.size() && (text[bad + badLength] & 0xC0) == 0x80) {
+      badLength++;
+    }
+    text.replace(bad, badLength, replace ? "\xEF\xBF\xBD" : "");
+  }
+
+  if (valid) {
+    result->bytesScored = (int) text.size();
+    result->validPrefixBytes = numBytes;
+  } else {
+    // Report the first invalid byte of the original input:
+    result->validPrefixBytes = validPrefixBytes;
+  }
+  if (text.capacity() > kMaxKeptTextBytes) {
+    std::string().swap(text);
+  }
+}
+
+// Returns the first clean boundary at or after start: just after ASCII
+// whitespace if there is some soon, else the next UTF-8 lead byte.
+static int
+FindPieceStart(const char *bytes, int numBytes, int start) {
+  if (start == 0) {
+    return 0;
+  }
+  int limit = std::min(numBytes, start + 256);
+  for(int i=start;i<limit;i++) {
+    char c = bytes[i - 1];
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+      return i;
+    }
+  }
+  while (start < numBytes && (bytes[start] & 0xC0) == 0x80) {
+    start++;
+  }
+  return start;
+}
+
+void RestrictLanguages(const LanguageSet &allowed, DetectResult *result) {
+  if (result->language3[0] != CLD2::UNKNOWN_LANGUAGE && !allowed.Contains(result->language3[0])) {
+    result->isReliable = false;
+  }
+  int kept = 0;
+  for(int idx=0;idx<3;idx++) {
+    if (allowed.Contains(result->language3[idx])) {
+      result->language3[kept] = result->language3[idx];
+      result->percent3[kept] = result->percent3[idx];
+      result->normalized_score3[kept] = result->normalized_score3[idx];
+      kept++;
+    }
+  }
+  for(;kept<3;kept++) {
+    result->language3[kept] = CLD2::UNKNOWN_LANGUAGE;
+    result->percent3[kept] = 0;
+    result->normalized_score3[kept] = 0.0;
+  }
+
+  CLD2::ResultChunkVector &chunks = result->resultChunkVector;
+  for(unsigned int i=0;i<chunks.size();i++) {
+    if (!allowed.Contains(chunks[i].lang1)) {
+      chunks[i].lang1 = CLD2::UNKNOWN_LANGUAGE;
+    }
+  }
+}
+
+void DetectSampled(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result) {
+  int windows = opts.maxBytes >= kSampledWindows * kMinSampleWindowBytes ? kSampledWindows : 1;
+  int windowBytes = opts.maxBytes / windows;
+
+  // Head, tail, middle:
+  int starts[kSampledWindows] = {0, numBytes - windowBytes, (numBytes - windowBytes) / 2};
+  int ends[kSampledWindows];
+  // Kept per thread, so their vectors and the merger's tables are
+  // allocated once rather than per call:
+  static thread_local DetectResult pieces[kSampledWindows];
+  static thread_local ResultMerger merger;
+  DetectOptions windowOpts = opts;
+  windowOpts.maxBytes = 0;
+
+  int scored = 0;
+  for(int w=0;w<windows;w++) {
+    int start = FindPieceStart(bytes, numBytes, starts[w]);
+    int end = std::min(numBytes, start + windowBytes);
+    if (end < numBytes) {
+      end = start + FindPieceEnd(bytes + start, end - start);
+    }
+    starts[w] = start;
+    ends[w] = end;
+    if (opts.trace != 0) {
+      opts.trace->SetNextPassOffset(start);
+    }
+    // Left from the last call if that one returned vectors:
+    pieces[w].resultChunkVector.clear();
+    DetectOne(bytes + start, end - start, windowOpts, &pieces[w]);
+    scored++;
+    if (pieces[w].validPrefixBytes < end - start) {
+      // Report it like a whole-text check would:
+      *result = pieces[w];
+      result->validPrefixBytes = start + pieces[w].validPrefixBytes;
+      return;
+    }
+    if (w == 1 && pieces[0].isReliable && pieces[1].isReliable &&
+        pieces[0].language3[0] == pieces[1].language3[0]) {
+      break;
+    }
+  }
+
+  // Merge in document order (head, middle, tail) so the vectors come
+  // out sorted:
+  static const int kDocumentOrder[kSampledWindows] = {0, 2, 1};
+
+  int lastEnd = 0;
+  for(int k=0;k<kSampledWindows;k++) {
+    int w = kDocumentOrder[k];
+    if (w >= scored) {
+      continue;
+    }
+    // Windows overlap when the text is not much longer than maxBytes:
+    if (starts[w] < lastEnd) {
+      continue;
+    }
+    merger.Add(pieces[w], starts[w]);
+    lastEnd = ends[w];
+  }
+  merger.Finish(result);
+  result->validPrefixBytes = numBytes;
+}
+
+void DetectParallel(const char *bytes, int numBytes, const DetectOptions &opts, int maxThreads, DetectResult *result) {
+  if (opts.trace != 0) {
+    // A trace is not shared between threads:
+    maxThreads = 1;
+  }
+  if (NeedsTranscoding(opts.sourceEncoding) && numBytes >= 2 * kMinParallelPieceBytes &&
+      maxThreads != 1 && !(opts.maxBytes > 0 && numBytes > opts.maxBytes)) {
+    // Pieces can only be cut cleanly in UTF-8, so convert it all first:
+    std::string text;
+    DetectOptions utf8Opts;
+    if (Transcode(bytes, numBytes, opts, &text, &utf8Opts, result)) {
+      DetectParallel(text.data(), (int) text.size(), utf8Opts, maxThreads, result);
+      result->validPrefixBytes = numBytes;
+    }
+    return;
+  }
+
+  WorkerPool *pool = GetWorkerPool();
+  if (maxThreads <= 0 || maxThreads > pool->size() + 1) {
+    maxThreads = pool->size() + 1;
+  }
+  if (maxThreads == 1 || numBytes < 2 * kMinParallelPieceBytes ||
+      (opts.maxBytes > 0 && numBytes > opts.maxBytes)) {
+    DetectOne(bytes, numBytes, opts, result);
+    return;
+  }
+
+  int pieceBytes = numBytes / (maxThreads * kParallelPiecesPerThread);
+  pieceBytes = std::max(kMinParallelPieceBytes, std::min(kMaxParallelPieceBytes, pieceBytes));
+
+  std::vector<int> starts;
+  int start = 0;
+  while (start < numBytes) {
+    starts.push_back(start);
+    int end = std::min(numBytes, start + pieceBytes);
+    if (end < numBytes) {
+      int cut = FindPieceEnd(bytes + start, end - start);
+      if (cut > 0) {
+        end = start + cut;
+      }
+    }
+    start = end;
+  }
+  starts.push_back(numBytes);
+
+  int count = (int) starts.size() - 1;
+  std::vector<DetectResult> pieces(count);
+  pool->ParallelFor(count, maxThreads, [&](int i) {
+      DetectOne(bytes + starts[i], starts[i + 1] - starts[i], opts, &pieces[i]);
+    });
+
+  ResultMerger merger;
+  for(int i=0;i<count;i++) {
+    if (pieces[i].validPrefixBytes < starts[i + 1] - starts[i]) {
+      *result = pieces[i];
+      result->validPrefixBytes = starts[i] + pieces[i].validPrefixBytes;
+      return;
+    }
+    merger.Add(pieces[i], starts[i]);
+  }
+  merger.Finish(result);
+  result->validPrefixBytes = numBytes;
+}
+
+CLD2::Language LanguageFromName(const char *name) {
+  typedef std::unordered_map<std::string, CLD2::Language> NameMap;
+  static const NameMap names = [] {
+    NameMap m;
+    for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+      CLD2::Language lang = static_cast<CLD2::Language>(i);
+      const char *keys[] = {CLD2::LanguageName(lang), CLD2::LanguageCode(lang)};
+      for(int k=0;k<2;k++) {
+        if (keys[k] != 0 && m.find(keys[k]) == m.end()) {
+          // Store CLD2's own answer, so both always agree:
+          m[keys[k]] = CLD2::GetLanguageFromName(keys[k]);
+        }
+      }
+    }
+    return m;
+  }();
+
+  NameMap::const_iterator it = names.find(name);
+  if (it != names.end()) {
+    return it->second;
+  }
+  // Not a canonical name or code (e.g. an alias); ask CLD2:
+  return CLD2::GetLanguageFromName(name);
+}
+
+int FindPieceEnd(const char *bytes, int numBytes) {
+  if (numBytes <= 0) {
+    return numBytes;
+  }
+  int limit = numBytes > kMaxWhitespaceBackoff ? numBytes - kMaxWhitespaceBackoff : 0;
+  for(int i=numBytes-1;i>=limit;i--) {
+    char c = bytes[i];
+    if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+      return i + 1;
+    }
+  }
+
+  // No whitespace: end just before the last UTF-8 sequence, unless
+  // that sequence is already complete:
+  int lead = numBytes - 1;
+  while (lead > 0 && lead > numBytes - 4 && (bytes[lead] & 0xC0) == 0x80) {
+    lead--;
+  }
+  unsigned char c = (unsigned char) bytes[lead];
+  int len = c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+  if (lead == 0 || lead + len <= numBytes) {
+    return numBytes;
+  }
+  return lead;
+}
+
+ResultMerger::ResultMerger()
+  : numPieces(0), langBytes(CLD2::NUM_LANGUAGES), langScore(CLD2::NUM_LANGUAGES) {
+  Reset();
+}
+
+void ResultMerger::Reset() {
+  for(unsigned int i=0;i<seenLangs.size();i++) {
+    langBytes[seenLangs[i]] = 0.0;
+    langScore[seenLangs[i]] = 0.0;
+  }
+  seenLangs.clear();
+  numPieces = 0;
+  textBytes = 0;
+  bytesScored = 0;
+  reliableBytes = 0;
+  chunks.clear();
+}
+
+void ResultMerger::Add(const DetectResult &piece, int pieceOffset) {
+  if (numPieces == 0) {
+    // Kept whole: a document that turns out to be one piece gets
+    // exactly the result detect() would give it.
+    first.isReliable = piece.isReliable;
+    memcpy(first.language3, piece.language3, sizeof(first.language3));
+    memcpy(first.percent3, piece.percent3, sizeof(first.percent3));
+    memcpy(first.normalized_score3, piece.normalized_score3, sizeof(first.normalized_score3));
+    first.textBytesFound = piece.textBytesFound;
+    first.validPrefixBytes = piece.validPrefixBytes;
+  }
+  bytesScored += piece.bytesScored;
+  numPieces++;
+
+  for(int idx=0;idx<3;idx++) {
+    CLD2::Language lang = piece.language3[idx];
+    if (lang == CLD2::UNKNOWN_LANGUAGE || lang < 0 || lang >= CLD2::NUM_LANGUAGES) {
+      continue;
+    }
+    double bytes = piece.textBytesFound * piece.percent3[idx] / 100.0;
+    if (bytes <= 0.0) {
+      continue;
+    }
+    if (langBytes[lang] == 0.0) {
+      seenLangs.push_back(lang);
+    }
+    langBytes[lang] += bytes;
+    langScore[lang] += bytes * piece.normalized_score3[idx];
+  }
+  textBytes += piece.textBytesFound;
+  if (piece.isReliable) {
+    reliableBytes += piece.textBytesFound;
+  }
+
+  const CLD2::ResultChunkVector &pieceChunks = piece.resultChunkVector;
+  for(unsigned int i=0;i<pieceChunks.size();i++) {
+    CLD2::ResultChunk chunk = pieceChunks[i];
+    chunk.offset += pieceOffset;
+    if (!chunks.empty()) {
+      // Rejoin a run of one language that the piece boundary split:
+      CLD2::ResultChunk &last = chunks.back();
+      if (i == 0 && last.lang1 == chunk.lang1 &&
+          last.offset + last.bytes == chunk.offset &&
+          last.bytes + chunk.bytes <= 0xFFFF) {
+        last.bytes += chunk.bytes;
+        continue;
+      }
+    }
+    chunks.push_back(chunk);
+  }
+}
+
+void ResultMerger::Finish(DetectResult *result) {
+  result->validPrefixBytes = 0;
+  result->resultChunkVector.swap(chunks);
+  chunks.clear();
+
+  if (numPieces == 1) {
+    result->isReliable = first.isReliable;
+    memcpy(result->language3, first.language3, sizeof(first.language3));
+    memcpy(result->percent3, first.percent3, sizeof(first.percent3));
+    memcpy(result->normalized_score3, first.normalized_score3, sizeof(first.normalized_score3));
+    result->textBytesFound = first.textBytesFound;
+    result->bytesScored = bytesScored;
+    Reset();
+    return;
+  }
+
+  for(int idx=0;idx<3;idx++) {
+    result->language3[idx] = CLD2::UNKNOWN_LANGUAGE;
+    result->percent3[idx] = 0;
+    result->normalized_score3[idx] = 0.0;
+  }
+
+  // Top three languages by text bytes:
+  for(unsigned int i=0;i<seenLangs.size() && textBytes>0;i++) {
+    int lang = seenLangs[i];
+    double bytes = langBytes[lang];
+    if (bytes <= 0.0) {
+      continue;
+    }
+    for(int idx=0;idx<3;idx++) {
+      CLD2::Language other = result->language3[idx];
+      if (other == CLD2::UNKNOWN_LANGUAGE || bytes > langBytes[other]) {
+        for(int j=2;j>idx;j--) {
+          result->language3[j] = result->language3[j-1];
+        }
+        result->language3[idx] = static_cast<CLD2::Language>(lang);
+        break;
+      }
+    }
+  }
+
+  for(int idx=0;idx<3;idx++) {
+    CLD2::Language lang = result->language3[idx];
+    if (lang != CLD2::UNKNOWN_LANGUAGE) {
+      result->percent3[idx] = (int) (100.0 * langBytes[lang] / textBytes);
+      result->normalized_score3[idx] = langScore[lang] / langBytes[lang];
+    }
+  }
+
+  result->textBytesFound = textBytes;
+  result->bytesScored = bytesScored;
+
+  // Reliable if most of the text was in pieces CLD2 was sure about:
+  result->isReliable = textBytes > 0 && 2 * (double) reliableBytes >= textBytes;
+
+  Reset();
+}
+
+StreamDetector::StreamDetector(const DetectOptions &options, int pieceBytes)
+  : opts(options), pieceBytes(pieceBytes), consumed(0) {
+  if (options.cldHints.tld_hint != 0) {
+    tldHint = options.cldHints.tld_hint;
+    opts.cldHints.tld_hint = tldHint.c_str();
+  }
+  if (options.cldHints.content_language_hint != 0) {
+    contentLanguageHint = options.cldHints.content_language_hint;
+    opts.cldHints.content_language_hint = contentLanguageHint.c_str();
+  }
+}
+
+void StreamDetector::Reset() {
+  pending.clear();
+  consumed = 0;
+  merger.Reset();
+}
+
+bool StreamDetector::DetectPiece(const char *bytes, int numBytes, int *badOffset) {
+  DetectOne(bytes, numBytes, opts, &piece);
+  if (piece.validPrefixBytes < numBytes) {
+    *badOffset = consumed + piece.validPrefixBytes;
+    Reset();
+    return false;
+  }
+  merger.Add(piece, consumed);
+  consumed += numBytes;
+  return true;
+}
+
+bool StreamDetector::Feed(const char *bytes, int numBytes, int *badOffset) {
+  int upto = 0;
+  while ((int) pending.size() + (numBytes - upto) >= pieceBytes) {
+    if (pending.empty()) {
+      // Detect straight from the caller's buffer, no copy:
+      int end = FindPieceEnd(bytes + upto, pieceBytes);
+      if (!DetectPiece(bytes + upto, end, badOffset)) {
+        return false;
+      }
+      upto += end;
+    } else {
+      int need = pieceBytes - (int) pending.size();
+      pending.append(bytes + upto, need);
+      upto += need;
+      int end = FindPieceEnd(pending.data(), (int) pending.size());
+      if (!DetectPiece(pending.data(), end, badOffset)) {
+        return false;
+      }
+      pending.erase(0, end);
+    }
+  }
+  pending.append(bytes + upto, numBytes - upto);
+  return true;
+}
+
+bool StreamDetector::Finish(DetectResult *result, int *badOffset) {
+  // An empty document still gets detected once, so the result matches
+  // detect(''):
+  if (!pending.empty() || consumed == 0) {
+    if (!DetectPiece(pending.data(), (int) pending.size(), badOffset)) {
+      return false;
+    }
+  }
+  merger.Finish(result);
+  Reset();
+  return true;
+}
@@ -0,0 +1,230 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Detection core shared by the Python bindings.  Nothing here touches
+// Python, so all of it may run with the GIL released.
+
+#ifndef PYCLD_DETECT_H_
+#define PYCLD_DETECT_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compact_lang_det.h"
+
+class DetectTrace;
+
+// CLD2::ExtDetectLanguageSummaryCheckUTF8, or the same function from
+// another table set's library; see tables.h:
+typedef CLD2::Language (*DetectFunction)(const char *buffer, int buffer_length, bool is_plain_text,
+                                         const CLD2::CLDHints *cld_hints, int flags,
+                                         CLD2::Language *language3, int *percent3,
+                                         double *normalized_score3,
+                                         CLD2::ResultChunkVector *resultchunkvector,
+                                         int *text_bytes, bool *is_reliable,
+                                         int *valid_prefix_bytes);
+
+// What DetectOne does with input that is not valid UTF-8:
+enum InvalidUTF8Mode {
+  // Detect nothing and report where the input went bad:
+  kInvalidUTF8Error,
+  // Replace each invalid sequence with U+FFFD and detect the result:
+  kInvalidUTF8Replace,
+  // Drop each invalid sequence and detect the result:
+  kInvalidUTF8Skip,
+};
+
+// A set of languages, one bit per CLD2::Language:
+struct LanguageSet {
+  uint64_t bits[(CLD2::NUM_LANGUAGES + 63) / 64];
+
+  bool Contains(int lang) const {
+    return lang >= 0 && lang < CLD2::NUM_LANGUAGES && (bits[lang / 64] >> (lang % 64) & 1) != 0;
+  }
+
+  void Add(int lang) {
+    bits[lang / 64] |= (uint64_t) 1 << (lang % 64);
+  }
+};
+
+// Everything one detection needs.  The hint strings are not owned:
+struct DetectOptions {
+  CLD2::CLDHints cldHints;
+  bool isPlainText;
+  bool returnVectors;
+  // Only changes how the bindings hand back the vectors:
+  bool columnarVectors;
+  int flags;
+  // If more than 0 and the text is longer, score only about this many
+  // bytes of it; see DetectSampled:
+  int maxBytes;
+  // 0 for the tables this module was linked with:
+  DetectFunction detect;
+  InvalidUTF8Mode invalidUTF8;
+  // What the input is encoded in; anything but UTF8 (or ASCII_7BIT) is
+  // converted to UTF-8 first, see DetectOne:
+  CLD2::Encoding sourceEncoding;
+  // If set, CLD2's results are restricted to these languages; see
+  // RestrictLanguages:
+  bool restrictLanguages;
+  LanguageSet languages;
+  // HashDetectOptions of the above, or 0 to never use the result cache:
+  uint64_t optionsHash;
+  // If set, every CLD2 call is recorded into it (see trace.h); traced
+  // calls skip the result cache and run on the calling thread only:
+  DetectTrace *trace;
+};
+
+// A DetectResult's validPrefixBytes if its input was not detected at
+// all because, converted to UTF-8, it would be over 2 GB.  Like any
+// validPrefixBytes under the input's size, it means there is no result:
+const int kInputTooLarge = -1;
+
+struct DetectResult {
+  bool isReliable;
+  CLD2::Language language3[3];
+  int percent3[3];
+  double normalized_score3[3];
+  int textBytesFound;
+  int validPrefixBytes;
+  // How many input bytes were actually scored:
+  int bytesScored;
+  CLD2::ResultChunkVector resultChunkVector;
+};
+
+// A DetectResult whose chunk vector is borrowed from a spare kept per
+// thread, and handed back (emptied, capacity kept) when it goes out of
+// scope, so detecting with vectors allocates nothing once the spare
+// has grown.  If two are live on one thread at once, the second finds
+// the spare taken and grows a vector of its own as usual:
+struct ScratchResult : public DetectResult {
+  ScratchResult();
+  ~ScratchResult();
+};
+
+// Detects bytes[0..numBytes), or copies the result from the result
+// cache (see cache.h) if it is enabled and has one, sampling the text
+// with DetectSampled if it is over opts.maxBytes.  Unless opts.invalidUTF8 is kInvalidUTF8Error,
+// invalid input is first scrubbed (see ScrubUTF8) into a copy, and
+// offsets and byte counts in the result refer to that copy.
+//
+// Input in another opts.sourceEncoding is first converted to UTF-8 (see
+// TranscodeToUTF8) in a buffer kept per thread, with bytes invalid in
+// that encoding handled as opts.invalidUTF8 says; characters CLD2
+// rejects in the converted text (e.g. control characters) are dropped.
+// Offsets and byte counts then refer to the converted text, and
+// validPrefixBytes to the input:
+void DetectOne(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+
+// Drops every language not in allowed from result's top three (moving
+// the rest up, so Unknown pads the end) and relabels its vectors as
+// Unknown.  Percents and scores are left as CLD2 gave them, so they
+// still describe the whole text, and the result is only reliable if
+// CLD2's own top language was allowed.  CLD2 still scores every
+// language; this only narrows what is reported.
+void RestrictLanguages(const LanguageSet &allowed, DetectResult *result);
+
+// Scores at most about opts.maxBytes of a long text, in windows at the
+// head, tail and middle (in that order), each cut on clean boundaries.
+// Stops after two windows if both are reliable and agree on the top
+// language.  The windows' results are merged as consecutive pieces
+// (ResultMerger), so vectors only cover scored windows, and only those
+// windows are checked for valid UTF-8.
+void DetectSampled(const char *bytes, int numBytes, const DetectOptions &opts, DetectResult *result);
+
+// Detects one long text by splitting it into pieces on clean
+// boundaries (see FindPieceEnd), detecting the pieces on up to
+// maxThreads threads of the worker pool (0 means all of them), and
+// merging the results with ResultMerger.  Must not be called from a
+// pool thread.  Short texts, and texts opts.maxBytes samples, are just
+// detected with DetectOne.
+void DetectParallel(const char *bytes, int numBytes, const DetectOptions &opts, int maxThreads, DetectResult *result);
+
+// Same as CLD2::GetLanguageFromName, but every language name and code
+// is resolved once up front into a hash table, so lookups are O(1):
+CLD2::Language LanguageFromName(const char *name);
+
+// Returns how many leading bytes of bytes[0..numBytes) to detect as one
+// piece so the next piece starts on a clean boundary: just after ASCII
+// whitespace if there is some near the end, else on a UTF-8 sequence
+// boundary.
+int FindPieceEnd(const char *bytes, int numBytes);
+
+// Combines the results of detecting consecutive pieces of one document
+// into one result: each language's percent and score are weighted by
+// the text bytes it had in each piece, and the vectors are
+// concatenated with their offsets moved to the whole document.
+class ResultMerger {
+ public:
+  ResultMerger();
+
+  void Reset();
+
+  // pieceOffset is where the piece starts in the whole document:
+  void Add(const DetectResult &piece, int pieceOffset);
+
+  void Finish(DetectResult *result);
+
+ private:
+  int numPieces;
+  DetectResult first;
+  std::vector<double> langBytes;
+  std::vector<double> langScore;
+  std::vector<int> seenLangs;
+  int textBytes;
+  int reliableBytes;
+  int bytesScored;
+  CLD2::ResultChunkVector chunks;
+};
+
+// Detects a document that arrives in arbitrary chunks, holding at most
+// about pieceBytes of it at a time.  Complete pieces are detected as
+// they fill up and merged with ResultMerger; a UTF-8 sequence split
+// across two chunks is carried over into the next piece.
+class StreamDetector {
+ public:
+  // Copies the hint strings, so opts need not outlive this:
+  StreamDetector(const DetectOptions &options, int pieceBytes);
+
+  // Returns false if a piece held invalid UTF-8; *badOffset is then its
+  // offset in the whole stream and the detector is reset.
+  bool Feed(const char *bytes, int numBytes, int *badOffset);
+
+  // Detects whatever is left and fills in the merged result for the
+  // whole stream, then resets for the next document.  Same return as
+  // Feed.
+  bool Finish(DetectResult *result, int *badOffset);
+
+  void Reset();
+
+  const DetectOptions &options() const {
+    return opts;
+  }
+
+ private:
+  bool DetectPiece(const char *bytes, int numBytes, int *badOffset);
+
+  DetectOptions opts;
+  std::string tldHint;
+  std::string contentLanguageHint;
+  int pieceBytes;
+  std::string pending;
+  int consumed;
+  ResultMerger merger;
+  DetectResult piece;
+};
+
+#endif  // PYCLD_DETECT_H_
@@ -14,6 +14,8 @@
 
 #include <stdio.h>
 #include <strings.h>
+#include <algorithm>
+#include <vector>
 #include "compact_lang_det.h"
 #include "encodings.h"
 
@@ -100,10 +102,37 @@ extern const cld_encoding cld_encoding_info[] = {
   {"SOFTBANK_ISO_2022_JP", CLD2::SOFTBANK_ISO_2022_JP},
 };
 
+static bool EncodingNameLess(int a, int b) {
+  return strcasecmp(cld_encoding_info[a].name, cld_encoding_info[b].name) < 0;
+}
+
+// Indices into cld_encoding_info, sorted case-insensitively by name;
+// built once, on first use:
+static const std::vector<int> &SortedEncodings() {
+  static const std::vector<int> sorted = [] {
+    std::vector<int> v;
+    for(int i=0;i<CLD2::NUM_ENCODINGS;i++) {
+      v.push_back(i);
+    }
+    std::sort(v.begin(), v.end(), EncodingNameLess);
+    return v;
+  }();
+  return sorted;
+}
+
 CLD2::Encoding EncodingFromName(const char *name) {
-  for(int i=0;i<CLD2::NUM_ENCODINGS;i++) {
-    if (!strcasecmp(cld_encoding_info[i].name, name)) {
-      return cld_encoding_info[i].encoding;
+  const std::vector<int> &sorted = SortedEncodings();
+  int lo = 0;
+  int hi = (int) sorted.size() - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int cmp = strcasecmp(cld_encoding_info[sorted[mid]].name, name);
+    if (cmp == 0) {
+      return cld_encoding_info[sorted[mid]].encoding;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
     }
   }
 
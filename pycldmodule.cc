@@ -12,11 +12,27 @@
 // limitations under the License.
 //
 
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <structmember.h>
+#include <limits.h>
+#include <string.h>
 #include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #if PY_MAJOR_VERSION >= 3
 #define IS_PY3K
+#else
+// Python.h only includes this from 3.x on:
+#include <structseq.h>
 #endif
 
 #include "compact_lang_det.h"
@@ -25,6 +41,15 @@
 // From ../../internal:
 #include "lang_script.h"
 
+#include "cache.h"
+#include "detect.h"
+#include "records.h"
+#include "stats.h"
+#include "tables.h"
+#include "trace.h"
+#include "transcode.h"
+#include "workers.h"
+
 // impl is in ./encodings.cc:
 CLD2::Encoding EncodingFromName(const char *name);
 
@@ -39,8 +64,80 @@ namespace CLD2 {
   extern const CharIntPair kNameToLanguage[];
 }
 
+#ifdef CLD2_DYNAMIC_MODE
+// Set once load_tables() has mapped the tables; nothing is detected
+// before then, and they are never unloaded, since other threads may be
+// detecting with the GIL released:
+static std::atomic<bool> tablesLoaded(false);
+static std::mutex tablesMu;
+#endif
+
+#ifdef IS_PY3K
+#define PyInt_FromLong PyLong_FromLong
+#define PyString_InternFromString PyUnicode_InternFromString
+#endif
+
+#if PY_VERSION_HEX >= 0x030B0000
+// Multi-phase init (PEP 489): each interpreter that imports the module
+// gets its own module object, state and heap types, and finds them
+// again from a method's type with PyType_GetModuleByDef.  Older
+// Pythons keep single-phase init and the static types:
+#define PYCLD_MULTI_PHASE
+#endif
+
+#if PY_VERSION_HEX >= 0x03090000
+// Calling a Detector goes straight to Detector_vectorcall (PEP 590),
+// skipping the argument tuple; older Pythons use tp_call:
+#define PYCLD_VECTORCALL
+#endif
+
+#ifdef IS_PY3K
+struct AsyncCompletions;
+typedef std::unordered_map<PyObject *, AsyncCompletions *> AsyncCompletionsMap;
+#endif
+
 struct PYCLDState {
   PyObject *error;
+
+  // The module's types: created per module under PYCLD_MULTI_PHASE,
+  // else the static types below:
+  PyTypeObject *hintsType;
+  PyTypeObject *detectorType;
+  PyTypeObject *detectionResultType;
+  PyTypeObject *detectionResultWithVectorsType;
+  PyTypeObject *languageDetailType;
+  PyTypeObject *chunkVectorsType;
+  PyTypeObject *traceType;
+  PyTypeObject *tracePassType;
+  PyTypeObject *traceChunkType;
+
+  // One interned name and code per CLD2::Language, created at import,
+  // so building results never creates these strings:
+  PyObject *languageNames[CLD2::NUM_LANGUAGES];
+  PyObject *languageCodes[CLD2::NUM_LANGUAGES];
+
+  // The (Unknown, un, 0, 0.0) entry that pads most details tuples:
+  PyObject *unknownDetail;
+
+  // Every (languageId, isReliable) and (languageCode, isReliable) that
+  // detect_id() and detect_code() can return, indexed by language and
+  // then isReliable, so they allocate nothing per call:
+  PyObject *idResults[CLD2::NUM_LANGUAGES][2];
+  PyObject *codeResults[CLD2::NUM_LANGUAGES][2];
+
+  // array.array, for results returned as packed arrays:
+  PyObject *arrayType;
+
+#ifdef IS_PY3K
+  // asyncio.get_running_loop, imported by the first detect_async();
+  // atomic since, without a GIL, two threads may import it at once:
+  std::atomic<PyObject *> getRunningLoop;
+
+  // The AsyncCompletions of every event loop in this interpreter with
+  // jobs pending, guarded by asyncMu; see detect_async:
+  AsyncCompletionsMap *asyncCompletions;
+  std::mutex *asyncMu;
+#endif
 };
 
 #ifdef IS_PY3K
@@ -50,347 +147,3634 @@ struct PYCLDState {
 static struct PYCLDState _state;
 #endif
 
+// The state of the module that created type (or a base of type), for
+// methods, which have no module object at hand:
+static struct PYCLDState *GetTypeState(PyTypeObject *type);
+
+// Resolves the four hint values into *cldHints.  The tld and HTTP
+// header strings are not copied:
+static bool
+ResolveHints(PyObject *CLDError,
+             const char *hintTopLevelDomain,
+             const char *hintLanguage,
+             const char *hintLanguageHTTPHeaders,
+             const char *hintEncoding,
+             CLD2::CLDHints *cldHints) {
+  cldHints->tld_hint = hintTopLevelDomain;
+  cldHints->content_language_hint = hintLanguageHTTPHeaders;
+
+  if (hintLanguage == 0) {
+    // no hint
+    cldHints->language_hint = CLD2::UNKNOWN_LANGUAGE;
+  } else {
+    cldHints->language_hint = LanguageFromName(hintLanguage);
+    if (cldHints->language_hint == CLD2::UNKNOWN_LANGUAGE) {
+      PyErr_Format(CLDError, "Unrecognized language hint name (got '%s'); see cld.LANGUAGES for recognized language names (note that currently external languages cannot be hinted)", hintLanguage);
+      return false;
+    }
+  }
+
+  if (hintEncoding == 0) {
+    // no hint
+    cldHints->encoding_hint = CLD2::UNKNOWN_ENCODING;
+  } else {
+    cldHints->encoding_hint = EncodingFromName(hintEncoding);
+    if (cldHints->encoding_hint == CLD2::UNKNOWN_ENCODING) {
+      PyErr_Format(CLDError, "Unrecognized encoding hint code (got '%s'); see cld.ENCODINGS for recognized encodings", hintEncoding);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Resolves languages, an iterable of language names or codes (None
+// for all languages), into *set; *restricted is false for None:
+static bool
+ResolveLanguages(PyObject *CLDError, PyObject *languages, bool *restricted, LanguageSet *set) {
+  *restricted = false;
+  if (languages == 0 || languages == Py_None) {
+    return true;
+  }
+  if (PyUnicode_Check(languages) || PyBytes_Check(languages)) {
+    PyErr_SetString(PyExc_TypeError, "languages must be a sequence of language names or codes, not a single string");
+    return false;
+  }
+  PyObject *iter = PyObject_GetIter(languages);
+  if (iter == 0) {
+    return false;
+  }
+  memset(set->bits, 0, sizeof(set->bits));
+  int count = 0;
+  PyObject *item;
+  while ((item = PyIter_Next(iter)) != 0) {
+#ifdef IS_PY3K
+    const char *name = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : 0;
+#else
+    const char *name = PyString_Check(item) ? PyString_AsString(item) : 0;
+#endif
+    CLD2::Language lang = name == 0 ? CLD2::UNKNOWN_LANGUAGE : LanguageFromName(name);
+    if (lang == CLD2::UNKNOWN_LANGUAGE) {
+      if (name == 0) {
+        if (!PyErr_Occurred()) {
+          PyErr_SetString(PyExc_TypeError, "languages must be a sequence of language names or codes");
+        }
+      } else {
+        PyErr_Format(CLDError, "Unrecognized language name in languages (got '%s'); see cld.LANGUAGES for recognized language names", name);
+      }
+      Py_DECREF(item);
+      Py_DECREF(iter);
+      return false;
+    }
+    Py_DECREF(item);
+    set->Add(lang);
+    count++;
+  }
+  Py_DECREF(iter);
+  if (PyErr_Occurred()) {
+    return false;
+  }
+  if (count == 0) {
+    PyErr_SetString(PyExc_ValueError, "languages must not be empty");
+    return false;
+  }
+  *restricted = true;
+  return true;
+}
+
+// Hints resolved once, with their own copies of the strings:
+struct HintsData {
+  std::string tld;
+  std::string contentLanguage;
+  CLD2::CLDHints cldHints;
+  bool restrictLanguages;
+  LanguageSet languages;
+};
+
+typedef struct {
+  PyObject_HEAD
+  HintsData *data;
+  // Set by the first __init__; data is never changed after that, since
+  // calls may be reading it with the GIL released:
+  std::atomic<bool> initialized;
+} HintsObject;
+
 static PyObject *
-detect(PyObject *self, PyObject *args, PyObject *kwArgs) {
-  char *bytes;
-  int numBytes;
+Hints_new(PyTypeObject *type, PyObject *args, PyObject *kwArgs) {
+  HintsObject *self = (HintsObject *) type->tp_alloc(type, 0);
+  if (self != 0) {
+    self->data = new HintsData();
+    ResolveHints(0, 0, 0, 0, 0, &self->data->cldHints);
+    self->data->restrictLanguages = false;
+    self->initialized.store(false);
+  }
+  return (PyObject *) self;
+}
 
+static int
+Hints_init(HintsObject *self, PyObject *args, PyObject *kwArgs) {
+  const char *hintTopLevelDomain = 0;
+  const char *hintLanguage = 0;
+  const char *hintLanguageHTTPHeaders = 0;
+  const char *hintEncoding = 0;
+  PyObject *languages = 0;
+
+  static const char *kwList[] = {"hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "languages",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "|zzzzO",
+                                   (char **) kwList,
+                                   &hintTopLevelDomain,
+                                   &hintLanguage,
+                                   &hintLanguageHTTPHeaders,
+                                   &hintEncoding,
+                                   &languages)) {
+    return -1;
+  }
+
+  PyObject *CLDError = GetTypeState(Py_TYPE(self))->error;
   CLD2::CLDHints cldHints;
-  cldHints.tld_hint = 0;
-  cldHints.content_language_hint = 0;
+  if (!ResolveHints(CLDError, hintTopLevelDomain, hintLanguage,
+                    hintLanguageHTTPHeaders, hintEncoding, &cldHints)) {
+    return -1;
+  }
+  bool restrictLanguages;
+  LanguageSet languageSet;
+  if (!ResolveLanguages(CLDError, languages, &restrictLanguages, &languageSet)) {
+    return -1;
+  }
 
-  int isPlainText = 0;
-  const char* hintLanguage = 0;
-  const char* hintEncoding = 0;
+  if (self->initialized.exchange(true)) {
+    PyErr_SetString(PyExc_RuntimeError, "Hints cannot be changed once initialized");
+    return -1;
+  }
+  HintsData *data = self->data;
+  data->cldHints = cldHints;
+  data->restrictLanguages = restrictLanguages;
+  data->languages = languageSet;
+  data->tld = hintTopLevelDomain != 0 ? hintTopLevelDomain : "";
+  data->cldHints.tld_hint = hintTopLevelDomain != 0 ? data->tld.c_str() : 0;
+  data->contentLanguage = hintLanguageHTTPHeaders != 0 ? hintLanguageHTTPHeaders : "";
+  data->cldHints.content_language_hint = hintLanguageHTTPHeaders != 0 ? data->contentLanguage.c_str() : 0;
+  return 0;
+}
 
-  int returnVectors = 0;
+// Frees self, an instance of one of the module's types:
+static void
+FreeObject(PyObject *self) {
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free(self);
+#ifdef PYCLD_MULTI_PHASE
+  // Instances of heap types own a reference to their type:
+  Py_DECREF(type);
+#endif
+}
 
-  int flagScoreAsQuads = 0;
-  int flagHTML = 0;
-  int flagCR = 0;
-  int flagVerbose = 0;
-  int flagQuiet = 0;
-  int flagEcho = 0;
-  int flagBestEffort = 0;
+static void
+Hints_dealloc(HintsObject *self) {
+  delete self->data;
+  FreeObject((PyObject *) self);
+}
 
-  static const char *kwList[] = {"utf8Bytes",
-                                 "isPlainText",
-                                 "hintTopLevelDomain",       // "id" boosts Indonesian
-                                 "hintLanguage",             // ITALIAN or it boosts it
-                                 "hintLanguageHTTPHeaders",  // "mi,en" boosts Maori and English
-                                 "hintEncoding",             // SJS boosts Japanese
-                                 "returnVectors",            // True if you want byte-ranges of each matched language (approx 2X perf hit)
+const char *HINTS_DOC =
+  "Hints(hintTopLevelDomain=None, hintLanguage=None,\n"
+  "      hintLanguageHTTPHeaders=None, hintEncoding=None, languages=None)\n\n"
+
+  "Detection hints, checked and resolved once.  Pass as hints= to\n"
+  "detect(), detect_batch(), detect_file() or Detector() in place of the\n"
+  "four hint keyword arguments and languages, which are then resolved on\n"
+  "every call.\n"
+  "The arguments are as for detect(); an unknown language or encoding\n"
+  "raises cld2.error here rather than on each call.  Hints are immutable:\n"
+  "calling __init__ again raises RuntimeError.";
+
+#ifdef PYCLD_MULTI_PHASE
+
+static PyType_Slot Hints_slots[] = {
+  {Py_tp_dealloc, (void *) Hints_dealloc},
+  {Py_tp_doc, (void *) HINTS_DOC},
+  {Py_tp_init, (void *) Hints_init},
+  {Py_tp_new, (void *) Hints_new},
+  {0, 0}
+};
 
-                                 /* Normally, several languages are detected solely by their Unicode script.
-                                    Combined with appropritate lookup tables, this flag forces them instead
-                                    to be detected via quadgrams. This can be a useful refinement when looking
-                                    for meaningful text in these languages, instead of just character sets.
-                                    The default tables do not support this use. */
-                                 "debugScoreAsQuads",
+static PyType_Spec Hints_spec = {
+#ifdef CLD2_FULL
+  "cld2full.Hints",
+#else
+  "cld2.Hints",
+#endif
+  sizeof(HintsObject),
+  0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+  Hints_slots
+};
 
-                                 /* For each detection call, write an HTML file to stderr, showing the text
-                                    chunks and their detected languages. */
-                                 "debugHTML",
+#else  // PYCLD_MULTI_PHASE
 
-                                 /* In that HTML file, force a new line for each chunk. */
-                                 "debugCR",
+static PyTypeObject HintsType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+#ifdef CLD2_FULL
+  "cld2full.Hints",                   /* tp_name */
+#else
+  "cld2.Hints",                       /* tp_name */
+#endif
+  sizeof(HintsObject),                /* tp_basicsize */
+  0,                                  /* tp_itemsize */
+  (destructor) Hints_dealloc,         /* tp_dealloc */
+  0,                                  /* tp_print */
+  0,                                  /* tp_getattr */
+  0,                                  /* tp_setattr */
+  0,                                  /* tp_compare */
+  0,                                  /* tp_repr */
+  0,                                  /* tp_as_number */
+  0,                                  /* tp_as_sequence */
+  0,                                  /* tp_as_mapping */
+  0,                                  /* tp_hash */
+  0,                                  /* tp_call */
+  0,                                  /* tp_str */
+  0,                                  /* tp_getattro */
+  0,                                  /* tp_setattro */
+  0,                                  /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+  HINTS_DOC,                          /* tp_doc */
+  0,                                  /* tp_traverse */
+  0,                                  /* tp_clear */
+  0,                                  /* tp_richcompare */
+  0,                                  /* tp_weaklistoffset */
+  0,                                  /* tp_iter */
+  0,                                  /* tp_iternext */
+  0,                                  /* tp_methods */
+  0,                                  /* tp_members */
+  0,                                  /* tp_getset */
+  0,                                  /* tp_base */
+  0,                                  /* tp_dict */
+  0,                                  /* tp_descr_get */
+  0,                                  /* tp_descr_set */
+  0,                                  /* tp_dictoffset */
+  (initproc) Hints_init,              /* tp_init */
+  0,                                  /* tp_alloc */
+  Hints_new,                          /* tp_new */
+};
 
-                                 /* In that HTML file, show every lookup entry. */
-                                 "debugVerbose",
+#endif  // PYCLD_MULTI_PHASE
+
+// Raw keyword values shared by detect() and the other detect_*
+// entry points; see ResolveDetectArgs:
+struct DetectArgs {
+  int isPlainText;
+  const char* hintTopLevelDomain;
+  const char* hintLanguage;
+  const char* hintLanguageHTTPHeaders;
+  const char* hintEncoding;
+  int returnVectors;
+  int flagScoreAsQuads;
+  int flagHTML;
+  int flagCR;
+  int flagVerbose;
+  int flagQuiet;
+  int flagEcho;
+  int flagBestEffort;
+  PyObject *hints;
+  int columnarVectors;
+  int maxBytes;
+  const char *tables;
+  const char *invalidUTF8;
+  PyObject *languages;
+  const char *encoding;
+};
 
-                                 /* In that HTML file, suppress most of the output detail. */
-                                 "debugQuiet",
+static void
+InitDetectArgs(DetectArgs *a) {
+  memset(a, 0, sizeof(DetectArgs));
+}
 
-                                 /* Echo every input buffer to stderr. */
-                                 "debugEcho",
+// Returns false with ValueError set if threads is negative; 0 means one
+// per CPU:
+static bool
+CheckThreads(int threads) {
+  if (threads < 0) {
+    PyErr_Format(PyExc_ValueError, "threads must not be negative (got %d)", threads);
+    return false;
+  }
+  return true;
+}
 
-                                 /* If true, allow low-quality results for short text,
-                                    rather than forcing the result to UNKNOWN_LANGUAGE. This may be of use for
-                                    those desiring approximate results on short input text, but there is no claim
-                                    that these results ave very good. make a guess at the language even if quality is low (text is short) */
-                                 "bestEffort",
+static bool
+ResolveDetectArgs(PyObject *CLDError, const DetectArgs &a, DetectOptions *opts) {
+  int tableSet = LinkedTableSetIndex();
+  if (a.tables != 0) {
+    tableSet = TableSetIndex(a.tables);
+    if (tableSet == -1) {
+      PyErr_Format(PyExc_ValueError, "tables must be 'small' or 'full' (got '%s')", a.tables);
+      return false;
+    }
+  }
+  std::string error;
+  if (!LoadTableSet(tableSet, &opts->detect, &error)) {
+    PyErr_SetString(CLDError, error.c_str());
+    return false;
+  }
+#ifdef CLD2_DYNAMIC_MODE
+  if (opts->detect == 0 && !tablesLoaded.load()) {
+    PyErr_SetString(CLDError, "no language tables are loaded; call load_tables(path) first");
+    return false;
+  }
+#endif
 
-                                 NULL};
+  opts->isPlainText = a.isPlainText != 0;
+  opts->columnarVectors = a.columnarVectors != 0;
+  opts->returnVectors = a.returnVectors != 0 || opts->columnarVectors;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "s#|izzzziiiiiiii",
-                                   (char **) kwList,
-                                   &bytes, &numBytes,
-                                   &isPlainText,
-                                   &cldHints.tld_hint,
-                                   &hintLanguage,
-                                   &cldHints.content_language_hint,
-                                   &hintEncoding,
-                                   &returnVectors,
-                                   &flagScoreAsQuads,
-                                   &flagHTML,
-                                   &flagCR,
-                                   &flagVerbose,
-                                   &flagQuiet,
-                                   &flagEcho,
-                                   &flagBestEffort)) {
-    return 0;
+  if (a.maxBytes < 0) {
+    PyErr_Format(PyExc_ValueError, "maxBytes must not be negative (got %d)", a.maxBytes);
+    return false;
+  }
+  opts->maxBytes = a.maxBytes;
+
+  if (a.invalidUTF8 == 0 || strcmp(a.invalidUTF8, "error") == 0) {
+    opts->invalidUTF8 = kInvalidUTF8Error;
+  } else if (strcmp(a.invalidUTF8, "replace") == 0) {
+    opts->invalidUTF8 = kInvalidUTF8Replace;
+  } else if (strcmp(a.invalidUTF8, "skip") == 0) {
+    opts->invalidUTF8 = kInvalidUTF8Skip;
+  } else {
+    PyErr_Format(PyExc_ValueError, "invalidUTF8 must be 'error', 'replace' or 'skip' (got '%s')", a.invalidUTF8);
+    return false;
   }
 
   int flags = 0;
-  if (flagScoreAsQuads != 0) {
+  if (a.flagScoreAsQuads != 0) {
     flags |= CLD2::kCLDFlagScoreAsQuads;
   }
-  if (flagHTML != 0) {
+  if (a.flagHTML != 0) {
     flags |= CLD2::kCLDFlagHtml;
   }
-  if (flagCR != 0) {
+  if (a.flagCR != 0) {
     flags |= CLD2::kCLDFlagCr;
   }
-  if (flagVerbose != 0) {
+  if (a.flagVerbose != 0) {
     flags |= CLD2::kCLDFlagVerbose;
   }
-  if (flagQuiet != 0) {
+  if (a.flagQuiet != 0) {
     flags |= CLD2::kCLDFlagQuiet;
   }
-  if (flagEcho != 0) {
+  if (a.flagEcho != 0) {
     flags |= CLD2::kCLDFlagEcho;
   }
-  if (flagBestEffort != 0) {
+  if (a.flagBestEffort != 0) {
     flags |= CLD2::kCLDFlagBestEffort;
   }
+  opts->flags = flags;
 
-  PyObject *CLDError = GETSTATE(self)->error;
+  if (a.hints != 0) {
+    if (a.hintTopLevelDomain != 0 || a.hintLanguage != 0 ||
+        a.hintLanguageHTTPHeaders != 0 || a.hintEncoding != 0 || a.languages != 0) {
+      PyErr_SetString(PyExc_TypeError, "pass either hints or the individual hint arguments and languages, not both");
+      return false;
+    }
+    // Points into the Hints object, which the caller's arguments keep
+    // alive:
+    const HintsData *data = ((HintsObject *) a.hints)->data;
+    opts->cldHints = data->cldHints;
+    opts->restrictLanguages = data->restrictLanguages;
+    opts->languages = data->languages;
+  } else if (!ResolveHints(CLDError, a.hintTopLevelDomain, a.hintLanguage,
+                           a.hintLanguageHTTPHeaders, a.hintEncoding, &opts->cldHints) ||
+             !ResolveLanguages(CLDError, a.languages, &opts->restrictLanguages, &opts->languages)) {
+    return false;
+  }
 
-  if (hintLanguage == 0) {
-    // no hint
-    cldHints.language_hint = CLD2::UNKNOWN_LANGUAGE;
-  } else {
-    cldHints.language_hint = CLD2::GetLanguageFromName(hintLanguage);
-    if (cldHints.language_hint == CLD2::UNKNOWN_LANGUAGE) {
-      PyErr_Format(CLDError, "Unrecognized language hint name (got '%s'); see cld.LANGUAGES for recognized language names (note that currently external languages cannot be hinted)", hintLanguage);
-      return 0;
+  opts->sourceEncoding = CLD2::UTF8;
+  if (a.encoding != 0) {
+    CLD2::Encoding encoding = EncodingFromName(a.encoding);
+    if (encoding == CLD2::UNKNOWN_ENCODING) {
+      PyErr_Format(CLDError, "Unrecognized encoding (got '%s'); see cld.ENCODINGS for recognized encodings", a.encoding);
+      return false;
+    }
+    std::string error;
+    if (!CanTranscode(encoding, &error)) {
+      PyErr_Format(PyExc_ValueError, "cannot detect text in %s: %s", a.encoding, error.c_str());
+      return false;
+    }
+    opts->sourceEncoding = encoding;
+    // What the text is in is the best encoding hint there is:
+    if (opts->cldHints.encoding_hint == CLD2::UNKNOWN_ENCODING && NeedsTranscoding(encoding)) {
+      opts->cldHints.encoding_hint = encoding;
     }
   }
 
-  if (hintEncoding == 0) {
-    // no hint
-    cldHints.encoding_hint = CLD2::UNKNOWN_ENCODING;
-  } else {
-    cldHints.encoding_hint = EncodingFromName(hintEncoding);
-    if (cldHints.encoding_hint == CLD2::UNKNOWN_ENCODING) {
-      PyErr_Format(CLDError, "Unrecognized encoding hint code (got '%s'); see cld.ENCODINGS for recognized encodings", hintEncoding);
-      return 0;
+  // The debug flags write to stderr on every call, so results with them
+  // are never cached:
+  const int debugFlags = CLD2::kCLDFlagHtml | CLD2::kCLDFlagCr | CLD2::kCLDFlagVerbose |
+    CLD2::kCLDFlagQuiet | CLD2::kCLDFlagEcho;
+  opts->optionsHash = (flags & debugFlags) != 0 ? 0 : HashDetectOptions(*opts);
+  opts->trace = 0;
+  return true;
+}
+
+// What opts says the input is encoded in, for error messages:
+static const char *
+InputEncodingName(const DetectOptions &opts) {
+  return NeedsTranscoding(opts.sourceEncoding) ? cld_encoding_info[opts.sourceEncoding].name : "UTF-8";
+}
+
+// Returns a new array.array of the given typecode holding a copy of
+// data:
+static PyObject *
+NewArray(struct PYCLDState *st, const char *typecode, const void *data, size_t numBytes) {
+  PyObject *bytes = PyBytes_FromStringAndSize((const char *) data, numBytes);
+  if (bytes == 0) {
+    return 0;
+  }
+  PyObject *result = PyObject_CallFunction(st->arrayType, (char *) "sO", typecode, bytes);
+  Py_DECREF(bytes);
+  return result;
+}
+
+#ifndef PYCLD_MULTI_PHASE
+static PyTypeObject DetectionResultType;
+static PyTypeObject DetectionResultWithVectorsType;
+static PyTypeObject LanguageDetailType;
+static PyTypeObject ChunkVectorsType;
+static PyTypeObject TraceType;
+static PyTypeObject TracePassType;
+static PyTypeObject TraceChunkType;
+#endif
+
+static PyStructSequence_Field DetectionResult_fields[] = {
+  {(char *) "isReliable", (char *) "True if the detection is high confidence"},
+  {(char *) "textBytesFound", (char *) "total number of bytes of text detected"},
+  {(char *) "details", (char *) "up to three LanguageDetails, best first"},
+  {(char *) "vectors", (char *) "(bytesOffset, bytesLength, languageName, languageCode) per detected byte range"},
+  {(char *) "bytesScored", (char *) "number of input bytes scored; less than the input when maxBytes sampled it"},
+  {(char *) "trace", (char *) "a Trace if traceEvery picked this call, else None"},
+  {0}
+};
+
+static PyStructSequence_Desc DetectionResult_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.DetectionResult",
+#else
+  (char *) "cld2.DetectionResult",
+#endif
+  (char *) "Result of detect(): isReliable, textBytesFound, details.",
+  DetectionResult_fields,
+  3
+};
+
+static PyStructSequence_Desc DetectionResultWithVectors_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.DetectionResultWithVectors",
+#else
+  (char *) "cld2.DetectionResultWithVectors",
+#endif
+  (char *) "Result of detect(returnVectors=True): isReliable, textBytesFound, details, vectors.",
+  DetectionResult_fields,
+  4
+};
+
+static PyStructSequence_Field LanguageDetail_fields[] = {
+  {(char *) "languageName", 0},
+  {(char *) "languageCode", 0},
+  {(char *) "percent", (char *) "percentage of the text detected as this language"},
+  {(char *) "score", (char *) "confidence score for this language"},
+  {0}
+};
+
+static PyStructSequence_Desc LanguageDetail_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.LanguageDetail",
+#else
+  (char *) "cld2.LanguageDetail",
+#endif
+  (char *) "One entry of DetectionResult.details.",
+  LanguageDetail_fields,
+  4
+};
+
+static PyStructSequence_Field ChunkVectors_fields[] = {
+  {(char *) "offsets", (char *) "array.array('i') of each vector's bytesOffset"},
+  {(char *) "lengths", (char *) "array.array('H') of each vector's bytesLength"},
+  {(char *) "languages", (char *) "array.array('H') of each vector's language id; see LANGUAGES_BY_ID"},
+  {0}
+};
+
+static PyStructSequence_Desc ChunkVectors_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.ChunkVectors",
+#else
+  (char *) "cld2.ChunkVectors",
+#endif
+  (char *) "DetectionResult.vectors when columnarVectors is True.",
+  ChunkVectors_fields,
+  3
+};
+
+static PyStructSequence_Field Trace_fields[] = {
+  {(char *) "seconds", (char *) "time the whole call took"},
+  {(char *) "passes", (char *) "a TracePass per call into CLD2, in the order made"},
+  {0}
+};
+
+static PyStructSequence_Desc Trace_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.Trace",
+#else
+  (char *) "cld2.Trace",
+#endif
+  (char *) "DetectionResult.trace of a traced call.",
+  Trace_fields,
+  2
+};
+
+static PyStructSequence_Field TracePass_fields[] = {
+  {(char *) "offset", (char *) "where this pass's text starts in the (converted or scrubbed) input"},
+  {(char *) "bytes", (char *) "length of this pass's text"},
+  {(char *) "seconds", (char *) "time CLD2 took on it"},
+  {(char *) "chunks", (char *) "a TraceChunk per chunk CLD2 scored"},
+  {0}
+};
+
+static PyStructSequence_Desc TracePass_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.TracePass",
+#else
+  (char *) "cld2.TracePass",
+#endif
+  (char *) "One entry of Trace.passes.",
+  TracePass_fields,
+  4
+};
+
+static PyStructSequence_Field TraceChunk_fields[] = {
+  {(char *) "offset", (char *) "bytes offset of the chunk in its pass's text"},
+  {(char *) "bytes", (char *) "length of the chunk"},
+  {(char *) "script", (char *) "ISO 15924 code of the script CLD2 finds most of in the chunk"},
+  {(char *) "languageCode", (char *) "the language CLD2 gave the chunk"},
+  {(char *) "candidates", (char *) "three LanguageDetails for the chunk's text on its own, best first"},
+  {0}
+};
+
+static PyStructSequence_Desc TraceChunk_desc = {
+#ifdef CLD2_FULL
+  (char *) "cld2full.TraceChunk",
+#else
+  (char *) "cld2.TraceChunk",
+#endif
+  (char *) "One entry of TracePass.chunks.",
+  TraceChunk_fields,
+  5
+};
+
+#ifndef PYCLD_MULTI_PHASE
+
+// Readies a static struct sequence type once per process and returns
+// it, or returns 0 with an exception set:
+static PyTypeObject *
+InitStructType(PyTypeObject *type, PyStructSequence_Desc *desc) {
+  if (type->tp_name != 0) {
+    return type;
+  }
+#if PY_VERSION_HEX >= 0x03040000
+  if (PyStructSequence_InitType2(type, desc) < 0) {
+    return 0;
+  }
+#else
+  PyStructSequence_InitType(type, desc);
+  if (PyErr_Occurred()) {
+    return 0;
+  }
+#endif
+  return type;
+}
+
+#endif  // PYCLD_MULTI_PHASE
+
+// PyStructSequence_New, with every field (hidden ones included) set to
+// None.  A hidden field left NULL crashes __reduce__, so pickling or
+// copying the result, and Python 2 leaves them uninitialized:
+static PyObject *
+NewStructSequence(PyTypeObject *type, int numFields) {
+  PyObject *result = PyStructSequence_New(type);
+  if (result != 0) {
+    for(int i=0;i<numFields;i++) {
+      Py_INCREF(Py_None);
+      PyStructSequence_SET_ITEM(result, i, Py_None);
+    }
+  }
+  return result;
+}
+
+// Replaces field i (None, from NewStructSequence) with value; steals
+// the reference to value:
+static inline void
+SetStructField(PyObject *result, int i, PyObject *value) {
+  PyObject *old = PyStructSequence_GET_ITEM(result, i);
+  PyStructSequence_SET_ITEM(result, i, value);
+  Py_XDECREF(old);
+}
+
+// Borrowed references to the interned name and code of lang:
+static inline PyObject *
+LanguageNameObject(struct PYCLDState *st, int lang) {
+  if (lang < 0 || lang >= CLD2::NUM_LANGUAGES) {
+    lang = CLD2::UNKNOWN_LANGUAGE;
+  }
+  return st->languageNames[lang];
+}
+
+static inline PyObject *
+LanguageCodeObject(struct PYCLDState *st, int lang) {
+  if (lang < 0 || lang >= CLD2::NUM_LANGUAGES) {
+    lang = CLD2::UNKNOWN_LANGUAGE;
+  }
+  return st->languageCodes[lang];
+}
+
+static PyObject *
+NewLanguageDetail(struct PYCLDState *st, CLD2::Language lang, int percent, double score) {
+  PyObject *detail = NewStructSequence(st->languageDetailType, 4);
+  if (detail == 0) {
+    return 0;
+  }
+  PyObject *pyPercent = PyInt_FromLong(percent);
+  PyObject *pyScore = PyFloat_FromDouble(score);
+  if (pyPercent == 0 || pyScore == 0) {
+    Py_XDECREF(pyPercent);
+    Py_XDECREF(pyScore);
+    Py_DECREF(detail);
+    return 0;
+  }
+  PyObject *name = LanguageNameObject(st, lang);
+  PyObject *code = LanguageCodeObject(st, lang);
+  Py_INCREF(name);
+  Py_INCREF(code);
+  // Steals refs:
+  SetStructField(detail, 0, name);
+  SetStructField(detail, 1, code);
+  SetStructField(detail, 2, pyPercent);
+  SetStructField(detail, 3, pyScore);
+  return detail;
+}
+
+// The vectors as three packed arrays, so no object is created per
+// chunk:
+static PyObject *
+BuildChunkVectors(struct PYCLDState *st, const CLD2::ResultChunkVector &chunks) {
+  size_t count = chunks.size();
+  std::vector<int> offsets(count);
+  std::vector<unsigned short> lengths(count);
+  std::vector<unsigned short> languages(count);
+  for(size_t i=0;i<count;i++) {
+    offsets[i] = chunks[i].offset;
+    lengths[i] = chunks[i].bytes;
+    languages[i] = chunks[i].lang1;
+  }
+
+  PyObject *result = NewStructSequence(st->chunkVectorsType, 3);
+  if (result == 0) {
+    return 0;
+  }
+  PyObject *pyOffsets = NewArray(st, "i", offsets.data(), count * sizeof(int));
+  PyObject *pyLengths = NewArray(st, "H", lengths.data(), count * sizeof(unsigned short));
+  PyObject *pyLanguages = NewArray(st, "H", languages.data(), count * sizeof(unsigned short));
+  if (pyOffsets == 0 || pyLengths == 0 || pyLanguages == 0) {
+    Py_XDECREF(pyOffsets);
+    Py_XDECREF(pyLengths);
+    Py_XDECREF(pyLanguages);
+    Py_DECREF(result);
+    return 0;
+  }
+  // Steals refs:
+  SetStructField(result, 0, pyOffsets);
+  SetStructField(result, 1, pyLengths);
+  SetStructField(result, 2, pyLanguages);
+  return result;
+}
+
+// The three LanguageDetails of a top three:
+static PyObject *
+BuildDetails(struct PYCLDState *st, const CLD2::Language *language3, const int *percent3, const double *normalized_score3) {
+  PyObject *details = PyTuple_New(3);
+  if (details == 0) {
+    return 0;
+  }
+  for(int idx=0;idx<3;idx++) {
+    CLD2::Language lang = language3[idx];
+    PyObject *item;
+    if (lang == CLD2::UNKNOWN_LANGUAGE && percent3[idx] == 0 && normalized_score3[idx] == 0.0) {
+      item = st->unknownDetail;
+      Py_INCREF(item);
+    } else {
+      item = NewLanguageDetail(st, lang, percent3[idx], normalized_score3[idx]);
+      if (item == 0) {
+        Py_DECREF(details);
+        return 0;
+      }
     }
+    // Steals ref:
+    PyTuple_SET_ITEM(details, idx, item);
   }
-    
-  bool isReliable;
-  CLD2::Language language3[3];
-  int percent3[3];
-  double normalized_score3[3];
-  int textBytesFound;
-  int validPrefixBytes;
-  CLD2::ResultChunkVector resultChunkVector;
+  return details;
+}
+
+static PyObject *
+BuildTraceChunk(struct PYCLDState *st, const TraceChunk &chunk) {
+  PyObject *candidates = BuildDetails(st, chunk.language3, chunk.percent3, chunk.normalized_score3);
+  if (candidates == 0) {
+    return 0;
+  }
+  PyObject *result = NewStructSequence(st->traceChunkType, 5);
+  PyObject *pyOffset = PyInt_FromLong(chunk.offset);
+  PyObject *pyBytes = PyInt_FromLong(chunk.bytes);
+  PyObject *pyScript = PyString_InternFromString(chunk.script);
+  if (result == 0 || pyOffset == 0 || pyBytes == 0 || pyScript == 0) {
+    Py_XDECREF(result);
+    Py_XDECREF(pyOffset);
+    Py_XDECREF(pyBytes);
+    Py_XDECREF(pyScript);
+    Py_DECREF(candidates);
+    return 0;
+  }
+  PyObject *code = LanguageCodeObject(st, chunk.language);
+  Py_INCREF(code);
+  // Steals refs:
+  SetStructField(result, 0, pyOffset);
+  SetStructField(result, 1, pyBytes);
+  SetStructField(result, 2, pyScript);
+  SetStructField(result, 3, code);
+  SetStructField(result, 4, candidates);
+  return result;
+}
+
+static PyObject *
+BuildTracePass(struct PYCLDState *st, const DetectTrace &trace, const TracePass &pass) {
+  PyObject *chunks = PyTuple_New(pass.numChunks);
+  if (chunks == 0) {
+    return 0;
+  }
+  for(int i=0;i<pass.numChunks;i++) {
+    PyObject *item = BuildTraceChunk(st, trace.chunks[pass.firstChunk + i]);
+    if (item == 0) {
+      Py_DECREF(chunks);
+      return 0;
+    }
+    // Steals ref:
+    PyTuple_SET_ITEM(chunks, i, item);
+  }
+  PyObject *result = NewStructSequence(st->tracePassType, 4);
+  PyObject *pyOffset = PyInt_FromLong(pass.offset);
+  PyObject *pyBytes = PyInt_FromLong(pass.bytes);
+  PyObject *pySeconds = PyFloat_FromDouble(pass.nanos / 1e9);
+  if (result == 0 || pyOffset == 0 || pyBytes == 0 || pySeconds == 0) {
+    Py_XDECREF(result);
+    Py_XDECREF(pyOffset);
+    Py_XDECREF(pyBytes);
+    Py_XDECREF(pySeconds);
+    Py_DECREF(chunks);
+    return 0;
+  }
+  // Steals refs:
+  SetStructField(result, 0, pyOffset);
+  SetStructField(result, 1, pyBytes);
+  SetStructField(result, 2, pySeconds);
+  SetStructField(result, 3, chunks);
+  return result;
+}
+
+static PyObject *
+BuildTrace(struct PYCLDState *st, const DetectTrace &trace) {
+  PyObject *passes = PyTuple_New(trace.passes.size());
+  if (passes == 0) {
+    return 0;
+  }
+  for(size_t i=0;i<trace.passes.size();i++) {
+    PyObject *item = BuildTracePass(st, trace, trace.passes[i]);
+    if (item == 0) {
+      Py_DECREF(passes);
+      return 0;
+    }
+    // Steals ref:
+    PyTuple_SET_ITEM(passes, i, item);
+  }
+  PyObject *result = NewStructSequence(st->traceType, 2);
+  PyObject *pySeconds = PyFloat_FromDouble(trace.nanos / 1e9);
+  if (result == 0 || pySeconds == 0) {
+    Py_XDECREF(result);
+    Py_XDECREF(pySeconds);
+    Py_DECREF(passes);
+    return 0;
+  }
+  // Steals refs:
+  SetStructField(result, 0, pySeconds);
+  SetStructField(result, 1, passes);
+  return result;
+}
+
+// trace, if not 0, becomes the result's trace field:
+static PyObject *
+BuildResult(struct PYCLDState *st, const DetectOptions &opts, const DetectResult &r, const DetectTrace *trace) {
+  PyObject *details = BuildDetails(st, r.language3, r.percent3, r.normalized_score3);
+  if (details == 0) {
+    return 0;
+  }
+
+  PyObject *result = NewStructSequence(opts.returnVectors ? st->detectionResultWithVectorsType : st->detectionResultType, 6);
+  PyObject *pyTextBytes = PyInt_FromLong(r.textBytesFound);
+  PyObject *pyBytesScored = PyInt_FromLong(r.bytesScored);
+  if (result == 0 || pyTextBytes == 0 || pyBytesScored == 0) {
+    Py_XDECREF(result);
+    Py_XDECREF(pyTextBytes);
+    Py_XDECREF(pyBytesScored);
+    Py_DECREF(details);
+    return 0;
+  }
+  PyObject *pyReliable = r.isReliable ? Py_True : Py_False;
+  Py_INCREF(pyReliable);
+  // Steals refs:
+  SetStructField(result, 0, pyReliable);
+  SetStructField(result, 1, pyTextBytes);
+  SetStructField(result, 2, details);
+  SetStructField(result, 4, pyBytesScored);
+
+  if (trace != 0) {
+    PyObject *pyTrace = BuildTrace(st, *trace);
+    if (pyTrace == 0) {
+      Py_DECREF(result);
+      return 0;
+    }
+    // Steals ref:
+    SetStructField(result, 5, pyTrace);
+  }
+
+  if (opts.returnVectors && opts.columnarVectors) {
+    PyObject *columns = BuildChunkVectors(st, r.resultChunkVector);
+    if (columns == 0) {
+      Py_DECREF(result);
+      return 0;
+    }
+    // Steals ref:
+    SetStructField(result, 3, columns);
+  } else if (opts.returnVectors) {
+    const CLD2::ResultChunkVector &resultChunkVector = r.resultChunkVector;
+    PyObject *resultChunks = PyTuple_New(resultChunkVector.size());
+    if (resultChunks == 0) {
+      Py_DECREF(result);
+      return 0;
+    }
+    // Steals ref:
+    SetStructField(result, 3, resultChunks);
+    for(unsigned int i=0;i<resultChunkVector.size();i++) {
+      const CLD2::ResultChunk &chunk = resultChunkVector[i];
+      PyObject *item = Py_BuildValue("(iiOO)",
+                                     chunk.offset, chunk.bytes,
+                                     LanguageNameObject(st, chunk.lang1),
+                                     LanguageCodeObject(st, chunk.lang1));
+      if (item == 0) {
+        Py_DECREF(result);
+        return 0;
+      }
+      // Steals ref:
+      PyTuple_SET_ITEM(resultChunks, i, item);
+    }
+  }
+
+  return result;
+}
+
+static PyObject *
+BuildResult(struct PYCLDState *st, const DetectOptions &opts, const DetectResult &r) {
+  return BuildResult(st, opts, r, 0);
+}
+
+// The UTF-8 bytes of one input, borrowed without copying from a str or
+// from any contiguous buffer-protocol object (bytes, bytearray,
+// memoryview, mmap, ...).  Exporting the buffer also stops a bytearray
+// from being resized while the GIL is released:
+struct InputBytes {
+  const char *bytes;
+  int numBytes;
+  PyObject *owner;
+  Py_buffer view;
+  bool hasView;
+};
+
+static void
+ReleaseInputBytes(InputBytes *in) {
+  if (in->hasView) {
+    PyBuffer_Release(&in->view);
+    in->hasView = false;
+  }
+  Py_CLEAR(in->owner);
+}
+
+// Fills in *in, returning false with an exception set if obj cannot
+// be read.  Every successful call needs a ReleaseInputBytes:
+static bool
+GetInputBytes(PyObject *obj, InputBytes *in) {
+  in->owner = 0;
+  in->hasView = false;
+
+  Py_ssize_t numBytes;
+  if (PyUnicode_Check(obj)) {
+#ifdef IS_PY3K
+    // Uses (and caches) the str's own UTF-8 form; for ASCII strs
+    // that is the str's storage itself:
+    in->bytes = PyUnicode_AsUTF8AndSize(obj, &numBytes);
+    if (in->bytes == 0) {
+      return false;
+    }
+    Py_INCREF(obj);
+    in->owner = obj;
+#else
+    in->owner = PyUnicode_AsUTF8String(obj);
+    if (in->owner == 0) {
+      return false;
+    }
+    in->bytes = PyBytes_AS_STRING(in->owner);
+    numBytes = PyBytes_GET_SIZE(in->owner);
+#endif
+  } else {
+    if (PyObject_GetBuffer(obj, &in->view, PyBUF_SIMPLE) != 0) {
+      return false;
+    }
+    in->hasView = true;
+    in->bytes = (const char *) in->view.buf;
+    numBytes = in->view.len;
+  }
+
+  if (numBytes > INT_MAX) {
+    ReleaseInputBytes(in);
+    PyErr_SetString(PyExc_OverflowError, "input is too large (more than 2 GB)");
+    return false;
+  }
+  in->numBytes = (int) numBytes;
+  return true;
+}
+
+// Sets error for an input of numBytes that r has no result for; what
+// names the input in the message:
+static void
+SetInputError(PyObject *error, const char *what, const DetectOptions &opts, const DetectResult &r, int numBytes) {
+  if (r.validPrefixBytes == kInputTooLarge) {
+    PyErr_Format(error, "%s is too large to detect: it would be over 2 GB as UTF-8 (from %s)", what, InputEncodingName(opts));
+  } else {
+    PyErr_Format(error, "%s contains invalid %s around byte %d (of %d)", what, InputEncodingName(opts), r.validPrefixBytes, numBytes);
+  }
+}
+
+// Detects in with the GIL released, counting it in the stats; returns
+// false with cld2.error set if the input is invalid:
+static bool
+DetectInput(struct PYCLDState *st, const InputBytes &in, const DetectOptions &opts, DetectResult *r) {
+  Py_BEGIN_ALLOW_THREADS
+  uint64_t t0 = StatsNow();
+  DetectOne(in.bytes, in.numBytes, opts, r);
+  StatsAddCall(StatsNow() - t0);
+  StatsAddBytes(in.numBytes);
+  if (r->validPrefixBytes < in.numBytes) {
+    StatsAddInvalid();
+  } else {
+    StatsAddResult(*r);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (r->validPrefixBytes < in.numBytes) {
+    SetInputError(st->error, "input", opts, *r, in.numBytes);
+    return false;
+  }
+  return true;
+}
+
+// The result of detect_id(), or of detect_code() if code is true:
+// a new reference to one of the tuples made at import:
+static PyObject *
+BuildTopResult(struct PYCLDState *st, const DetectResult &r, bool code) {
+  int lang = r.language3[0];
+  if (lang < 0 || lang >= CLD2::NUM_LANGUAGES) {
+    lang = CLD2::UNKNOWN_LANGUAGE;
+  }
+  PyObject *result = code ? st->codeResults[lang][r.isReliable] : st->idResults[lang][r.isReliable];
+  Py_INCREF(result);
+  return result;
+}
+
+static PyObject *
+detect(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *utf8Bytes;
+  int threads = 1;
+  int traceEvery = 0;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"utf8Bytes",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",       // "id" boosts Indonesian
+                                 "hintLanguage",             // ITALIAN or it boosts it
+                                 "hintLanguageHTTPHeaders",  // "mi,en" boosts Maori and English
+                                 "hintEncoding",             // SJS boosts Japanese
+                                 "returnVectors",            // True if you want byte-ranges of each matched language (approx 2X perf hit)
+
+                                 /* Normally, several languages are detected solely by their Unicode script.
+                                    Combined with appropritate lookup tables, this flag forces them instead
+                                    to be detected via quadgrams. This can be a useful refinement when looking
+                                    for meaningful text in these languages, instead of just character sets.
+                                    The default tables do not support this use. */
+                                 "debugScoreAsQuads",
+
+                                 /* For each detection call, write an HTML file to stderr, showing the text
+                                    chunks and their detected languages. */
+                                 "debugHTML",
+
+                                 /* In that HTML file, force a new line for each chunk. */
+                                 "debugCR",
+
+                                 /* In that HTML file, show every lookup entry. */
+                                 "debugVerbose",
+
+                                 /* In that HTML file, suppress most of the output detail. */
+                                 "debugQuiet",
+
+                                 /* Echo every input buffer to stderr. */
+                                 "debugEcho",
+
+                                 /* If true, allow low-quality results for short text,
+                                    rather than forcing the result to UNKNOWN_LANGUAGE. This may be of use for
+                                    those desiring approximate results on short input text, but there is no claim
+                                    that these results ave very good. make a guess at the language even if quality is low (text is short) */
+                                 "bestEffort",
+
+                                 /* A cld2.Hints, instead of the four hint* arguments. */
+                                 "hints",
+
+                                 /* Return the vectors as packed arrays instead of tuples. */
+                                 "columnarVectors",
+
+                                 /* If more than 0, score only about this many bytes of longer
+                                    texts, sampled from the head, tail and middle. */
+                                 "maxBytes",
+
+                                 /* 'small' or 'full': which CLD2 tables to detect with. */
+                                 "tables",
+
+                                 /* 'error', 'replace' or 'skip': what to do with invalid UTF-8. */
+                                 "invalidUTF8",
+
+                                 /* If not 1, detect a long text in pieces on up to this many
+                                    native threads (0 means one per CPU). */
+                                 "threads",
+
+                                 /* Language names or codes; report only these languages. */
+                                 "languages",
+
+                                 /* A name from ENCODINGS: utf8Bytes is in this encoding instead. */
+                                 "encoding",
+
+                                 /* If more than 0, record a Trace of one in this many calls
+                                    (per thread) in the result's trace field. */
+                                 "traceEvery",
+
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|izzzziiiiiiiiO!iizziOzi",
+                                   (char **) kwList,
+                                   &utf8Bytes,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.returnVectors,
+                                   &a.flagScoreAsQuads,
+                                   &a.flagHTML,
+                                   &a.flagCR,
+                                   &a.flagVerbose,
+                                   &a.flagQuiet,
+                                   &a.flagEcho,
+                                   &a.flagBestEffort,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.columnarVectors,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &threads,
+                                   &a.languages,
+                                   &a.encoding,
+                                   &traceEvery)) {
+    return 0;
+  }
+
+  if (!CheckThreads(threads)) {
+    return 0;
+  }
+
+  DetectOptions opts;
+  if (!ResolveDetectArgs(GETSTATE(self)->error, a, &opts)) {
+    return 0;
+  }
+
+  InputBytes in;
+  if (!GetInputBytes(utf8Bytes, &in)) {
+    return 0;
+  }
+
+  ScratchResult r;
+  std::unique_ptr<DetectTrace> trace;
+  if (TraceSampled(traceEvery)) {
+    trace.reset(new DetectTrace());
+    opts.trace = trace.get();
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  uint64_t t0 = StatsNow();
+  DetectParallel(in.bytes, in.numBytes, opts, threads, &r);
+  uint64_t elapsed = StatsNow() - t0;
+  if (trace) {
+    trace->nanos = elapsed;
+  }
+  StatsAddCall(elapsed);
+  StatsAddBytes(in.numBytes);
+  if (r.validPrefixBytes < in.numBytes) {
+    StatsAddInvalid();
+  } else {
+    StatsAddResult(r);
+  }
+  Py_END_ALLOW_THREADS
+
+  ReleaseInputBytes(&in);
+
+  if (r.validPrefixBytes < in.numBytes) {
+    SetInputError(GETSTATE(self)->error, "input", opts, r, in.numBytes);
+    return 0;
+  }
+
+  return BuildResult(GETSTATE(self), opts, r, trace.get());
+}
+
+// detect_id() if code is false, else detect_code():
+static PyObject *
+DetectTop(PyObject *self, PyObject *args, PyObject *kwArgs, bool code) {
+  PyObject *utf8Bytes;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"utf8Bytes",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "bestEffort",
+                                 "hints",
+                                 "maxBytes",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 "encoding",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|izzzziO!izzOz",
+                                   (char **) kwList,
+                                   &utf8Bytes,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.flagBestEffort,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages,
+                                   &a.encoding)) {
+    return 0;
+  }
+
+  struct PYCLDState *st = GETSTATE(self);
+  DetectOptions opts;
+  if (!ResolveDetectArgs(st->error, a, &opts)) {
+    return 0;
+  }
+
+  InputBytes in;
+  if (!GetInputBytes(utf8Bytes, &in)) {
+    return 0;
+  }
+  ScratchResult r;
+  bool ok = DetectInput(st, in, opts, &r);
+  ReleaseInputBytes(&in);
+  return ok ? BuildTopResult(st, r, code) : 0;
+}
+
+static PyObject *
+detect_id(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  return DetectTop(self, args, kwArgs, false);
+}
+
+static PyObject *
+detect_code(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  return DetectTop(self, args, kwArgs, true);
+}
+
+static PyObject *
+detect_batch(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *sequence;
+  int threads = 0;
+  int traceEvery = 0;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"sequence",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "returnVectors",
+                                 "debugScoreAsQuads",
+                                 "debugHTML",
+                                 "debugCR",
+                                 "debugVerbose",
+                                 "debugQuiet",
+                                 "debugEcho",
+                                 "bestEffort",
+                                 "threads",
+                                 "hints",
+                                 "columnarVectors",
+                                 "maxBytes",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 "encoding",
+                                 "traceEvery",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|izzzziiiiiiiiiO!iizzOzi",
+                                   (char **) kwList,
+                                   &sequence,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.returnVectors,
+                                   &a.flagScoreAsQuads,
+                                   &a.flagHTML,
+                                   &a.flagCR,
+                                   &a.flagVerbose,
+                                   &a.flagQuiet,
+                                   &a.flagEcho,
+                                   &a.flagBestEffort,
+                                   &threads,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.columnarVectors,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages,
+                                   &a.encoding,
+                                   &traceEvery)) {
+    return 0;
+  }
+
+  if (!CheckThreads(threads)) {
+    return 0;
+  }
+
+  DetectOptions opts;
+  if (!ResolveDetectArgs(GETSTATE(self)->error, a, &opts)) {
+    return 0;
+  }
+
+  // A tuple copy, which owns its items: read in place, a list could be
+  // shrunk or changed under us by another thread (free-threaded builds
+  // have no GIL) or by an input's __buffer__ while we collect them:
+  PyObject *seq = PySequence_Tuple(sequence);
+  if (seq == 0) {
+    if (PyErr_ExceptionMatches(PyExc_TypeError)) {
+      PyErr_SetString(PyExc_TypeError, "detect_batch expects a sequence of texts");
+    }
+    return 0;
+  }
+  Py_ssize_t count = PyTuple_GET_SIZE(seq);
+  if (count > INT_MAX) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_OverflowError, "too many inputs");
+    return 0;
+  }
+
+  // Collect every input up front, holding the GIL:
+  std::vector<InputBytes> inputs(count);
+  Py_ssize_t numInputs = 0;
+  PyObject *result = 0;
+  for(;numInputs<count;numInputs++) {
+    if (!GetInputBytes(PyTuple_GET_ITEM(seq, numInputs), &inputs[numInputs])) {
+      goto done;
+    }
+  }
+
+  {
+    std::vector<DetectResult> results(count);
+
+    // Which inputs to trace is decided here, on the calling thread, so
+    // the rate holds however the pool splits the batch:
+    std::vector<std::unique_ptr<DetectTrace> > traces;
+    if (traceEvery > 0) {
+      traces.resize(count);
+      for(Py_ssize_t i=0;i<count;i++) {
+        if (TraceSampled(traceEvery)) {
+          traces[i].reset(new DetectTrace());
+        }
+      }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    GetWorkerPool()->ParallelFor((int) count, threads, [&](int i) {
+        uint64_t start = StatsNow();
+        if (!traces.empty() && traces[i]) {
+          DetectOptions traceOpts = opts;
+          traceOpts.trace = traces[i].get();
+          DetectOne(inputs[i].bytes, inputs[i].numBytes, traceOpts, &results[i]);
+          traces[i]->nanos = StatsNow() - start;
+        } else {
+          DetectOne(inputs[i].bytes, inputs[i].numBytes, opts, &results[i]);
+        }
+        StatsAddCall(StatsNow() - start);
+        StatsAddBytes(inputs[i].numBytes);
+        if (results[i].validPrefixBytes < inputs[i].numBytes) {
+          StatsAddInvalid();
+        } else {
+          StatsAddResult(results[i]);
+        }
+      });
+    Py_END_ALLOW_THREADS
+
+    for(Py_ssize_t i=0;i<count;i++) {
+      if (results[i].validPrefixBytes < inputs[i].numBytes) {
+        char what[32];
+        snprintf(what, sizeof(what), "input %zd", i);
+        SetInputError(GETSTATE(self)->error, what, opts, results[i], inputs[i].numBytes);
+        goto done;
+      }
+    }
+
+    result = PyList_New(count);
+    if (result == 0) {
+      goto done;
+    }
+    for(Py_ssize_t i=0;i<count;i++) {
+      PyObject *item = BuildResult(GETSTATE(self), opts, results[i], traces.empty() ? 0 : traces[i].get());
+      if (item == 0) {
+        Py_CLEAR(result);
+        goto done;
+      }
+      // Steals ref:
+      PyList_SET_ITEM(result, i, item);
+    }
+  }
+
+ done:
+  for(Py_ssize_t i=0;i<numInputs;i++) {
+    ReleaseInputBytes(&inputs[i]);
+  }
+  Py_DECREF(seq);
+  return result;
+}
+
+// Records are handed to threads in blocks this big, so tiny records do
+// not all contend on the shared counter:
+static const int kRecordsPerTask = 1024;
+
+static PyObject *
+detect_file(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *pathArg;
+  const char *delimiterBytes = "\n";
+  Py_ssize_t delimiterLength = 1;
+  int lengthPrefix = 0;
+  int threads = 0;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"path",
+                                 "delimiter",
+                                 "lengthPrefix",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "bestEffort",
+                                 "threads",
+                                 "hints",
+                                 "maxBytes",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 "encoding",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|s#iizzzziiO!izzOz",
+                                   (char **) kwList,
+                                   &pathArg,
+                                   &delimiterBytes, &delimiterLength,
+                                   &lengthPrefix,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.flagBestEffort,
+                                   &threads,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages,
+                                   &a.encoding)) {
+    return 0;
+  }
+
+  if (!CheckThreads(threads)) {
+    return 0;
+  }
+
+  DetectOptions opts;
+  if (!ResolveDetectArgs(GETSTATE(self)->error, a, &opts)) {
+    return 0;
+  }
+
+  PyObject *pathBytes;
+#ifdef IS_PY3K
+  if (!PyUnicode_FSConverter(pathArg, &pathBytes)) {
+    return 0;
+  }
+#else
+  if (!PyString_Check(pathArg)) {
+    PyErr_SetString(PyExc_TypeError, "path must be a str");
+    return 0;
+  }
+  pathBytes = pathArg;
+  Py_INCREF(pathBytes);
+#endif
+
+  std::string delimiter(delimiterBytes, delimiterLength);
+  MappedFile file;
+  std::vector<Record> records;
+  std::string error;
+  bool opened;
+  bool split = false;
+  std::vector<unsigned short> langs;
+  std::vector<unsigned char> percents;
+  std::vector<signed char> reliable;
+
+  Py_BEGIN_ALLOW_THREADS
+  opened = file.Open(PyBytes_AS_STRING(pathBytes), &error);
+  if (opened) {
+    if (lengthPrefix != 0) {
+      split = SplitLengthPrefixed(file.data(), file.size(), lengthPrefix, &records, &error);
+    } else {
+      split = SplitDelimited(file.data(), file.size(), delimiter, &records, &error);
+    }
+    if (split && records.size() > (size_t) INT_MAX) {
+      error = "too many records";
+      split = false;
+    }
+  }
+  if (split) {
+    int count = (int) records.size();
+    langs.resize(count);
+    percents.resize(count);
+    reliable.resize(count);
+    GetWorkerPool()->ParallelFor((count + kRecordsPerTask - 1) / kRecordsPerTask, threads, [&](int task) {
+        ScratchResult r;
+        int end = std::min(count, (task + 1) * kRecordsPerTask);
+        for(int i=task*kRecordsPerTask;i<end;i++) {
+          uint64_t t0 = StatsNow();
+          DetectOne(records[i].bytes, records[i].numBytes, opts, &r);
+          StatsAddCall(StatsNow() - t0);
+          StatsAddBytes(records[i].numBytes);
+          if (r.validPrefixBytes < records[i].numBytes) {
+            StatsAddInvalid();
+            langs[i] = CLD2::UNKNOWN_LANGUAGE;
+            percents[i] = 0;
+            reliable[i] = -1;
+          } else {
+            StatsAddResult(r);
+            langs[i] = r.language3[0];
+            percents[i] = r.percent3[0];
+            reliable[i] = r.isReliable ? 1 : 0;
+          }
+        }
+      });
+  }
+  Py_END_ALLOW_THREADS
+
+  Py_DECREF(pathBytes);
+
+  if (!opened) {
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return 0;
+  }
+  if (!split) {
+    PyErr_SetString(GETSTATE(self)->error, error.c_str());
+    return 0;
+  }
+
+  struct PYCLDState *st = GETSTATE(self);
+  PyObject *pyLangs = NewArray(st, "H", langs.data(), langs.size() * sizeof(unsigned short));
+  PyObject *pyPercents = NewArray(st, "B", percents.data(), percents.size());
+  PyObject *pyReliable = NewArray(st, "b", reliable.data(), reliable.size());
+  PyObject *result = 0;
+  if (pyLangs != 0 && pyPercents != 0 && pyReliable != 0) {
+    result = PyTuple_Pack(3, pyLangs, pyPercents, pyReliable);
+  }
+  Py_XDECREF(pyLangs);
+  Py_XDECREF(pyPercents);
+  Py_XDECREF(pyReliable);
+  return result;
+}
+
+// The one format character of a buffer of plain items, ignoring a
+// native or little-endian byte order prefix; 0 for anything else:
+static char
+BufferFormatChar(const Py_buffer &view) {
+  const char *format = view.format == 0 ? "B" : view.format;
+  if (*format == '@' || *format == '=' || *format == '<') {
+    format++;
+  }
+  return format[0] != 0 && format[1] == 0 ? format[0] : 0;
+}
+
+// Gets a contiguous buffer of obj, whose items must be itemSize bytes
+// and have one of the format characters in formats.  Returns false
+// with an exception set otherwise; every successful call needs a
+// PyBuffer_Release:
+static bool
+GetColumnBuffer(PyObject *obj, const char *name, bool writable, int itemSize, const char *formats, Py_buffer *view) {
+  if (PyObject_GetBuffer(obj, view, PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) != 0) {
+    return false;
+  }
+  char format = BufferFormatChar(*view);
+  if (view->itemsize != itemSize || format == 0 || strchr(formats, format) == 0) {
+    PyErr_Format(PyExc_TypeError, "%s must be a buffer of %d-byte integers (typecode one of '%s'; got '%s', itemsize %zd)",
+                 name, itemSize, formats, view->format == 0 ? "B" : view->format, view->itemsize);
+    PyBuffer_Release(view);
+    return false;
+  }
+  return true;
+}
+
+// Reads offsets[i], which need not be aligned:
+template <typename Offset>
+static inline int64_t
+LoadOffset(const char *offsets, Py_ssize_t i) {
+  Offset offset;
+  memcpy(&offset, offsets + i * sizeof(Offset), sizeof(Offset));
+  return (int64_t) offset;
+}
+
+// Returns -1 if the count + 1 offsets are valid for dataBytes of data,
+// else the first row they are not valid for:
+template <typename Offset>
+static Py_ssize_t
+CheckColumnOffsets(const char *offsets, Py_ssize_t count, Py_ssize_t dataBytes) {
+  int64_t start = LoadOffset<Offset>(offsets, 0);
+  if (start < 0) {
+    return 0;
+  }
+  for(Py_ssize_t i=0;i<count;i++) {
+    int64_t end = LoadOffset<Offset>(offsets, i + 1);
+    if (end < start || end > dataBytes || end - start > INT_MAX) {
+      return i;
+    }
+    start = end;
+  }
+  return -1;
+}
+
+// Detects each of count rows, row i being data[offsets[i]..offsets[i+1]),
+// like detect_file() detects records; percents and reliable may be 0:
+template <typename Offset>
+static void
+DetectColumn(const char *data, const char *offsets, int count, const DetectOptions &opts, int threads,
+             unsigned short *langs, unsigned char *percents, signed char *reliable) {
+  GetWorkerPool()->ParallelFor((count + kRecordsPerTask - 1) / kRecordsPerTask, threads, [&](int task) {
+      ScratchResult r;
+      int end = std::min(count, (task + 1) * kRecordsPerTask);
+      for(int i=task*kRecordsPerTask;i<end;i++) {
+        int64_t start = LoadOffset<Offset>(offsets, i);
+        int numBytes = (int) (LoadOffset<Offset>(offsets, i + 1) - start);
+        uint64_t t0 = StatsNow();
+        DetectOne(data + start, numBytes, opts, &r);
+        StatsAddCall(StatsNow() - t0);
+        StatsAddBytes(numBytes);
+        bool valid = r.validPrefixBytes >= numBytes;
+        if (valid) {
+          StatsAddResult(r);
+        } else {
+          StatsAddInvalid();
+        }
+        langs[i] = valid ? r.language3[0] : CLD2::UNKNOWN_LANGUAGE;
+        if (percents != 0) {
+          percents[i] = valid ? r.percent3[0] : 0;
+        }
+        if (reliable != 0) {
+          reliable[i] = valid ? (r.isReliable ? 1 : 0) : -1;
+        }
+      }
+    });
+}
+
+static PyObject *
+detect_column(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *dataArg;
+  PyObject *offsetsArg;
+  PyObject *langsArg;
+  PyObject *percentsArg = Py_None;
+  PyObject *reliableArg = Py_None;
+  int offsetWidth = 0;
+  int threads = 0;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"data",
+                                 "offsets",
+                                 "outLanguages",
+                                 "outPercents",
+                                 "outReliable",
+                                 "offsetWidth",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "bestEffort",
+                                 "threads",
+                                 "hints",
+                                 "maxBytes",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 "encoding",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "OOO|OOiizzzziiO!izzOz",
+                                   (char **) kwList,
+                                   &dataArg,
+                                   &offsetsArg,
+                                   &langsArg,
+                                   &percentsArg,
+                                   &reliableArg,
+                                   &offsetWidth,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.flagBestEffort,
+                                   &threads,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages,
+                                   &a.encoding)) {
+    return 0;
+  }
+
+  if (offsetWidth != 0 && offsetWidth != 4 && offsetWidth != 8) {
+    PyErr_Format(PyExc_ValueError, "offsetWidth must be 0, 4 or 8 (got %d)", offsetWidth);
+    return 0;
+  }
+
+  if (!CheckThreads(threads)) {
+    return 0;
+  }
+
+  DetectOptions opts;
+  if (!ResolveDetectArgs(GETSTATE(self)->error, a, &opts)) {
+    return 0;
+  }
+
+  Py_buffer data, offsets, langs, percents, reliable;
+  bool hasData = false, hasOffsets = false, hasLangs = false, hasPercents = false, hasReliable = false;
+  PyObject *result = 0;
+  Py_ssize_t count = 0;
+  Py_ssize_t badRow;
+  int width;
+
+  if (PyObject_GetBuffer(dataArg, &data, PyBUF_SIMPLE) != 0) {
+    goto done;
+  }
+  hasData = true;
+
+  // Typed offsets (e.g. array('i'), numpy int64) say their own width;
+  // raw bytes (e.g. a pyarrow Buffer) need offsetWidth:
+  if (PyObject_GetBuffer(offsetsArg, &offsets, PyBUF_FORMAT) != 0) {
+    goto done;
+  }
+  hasOffsets = true;
+  width = (int) offsets.itemsize;
+  if (width == 1 && strchr("bBc", BufferFormatChar(offsets)) != 0 && offsetWidth != 0) {
+    width = offsetWidth;
+  } else if ((width != 4 && width != 8) || strchr("iIlLqQ", BufferFormatChar(offsets)) == 0 ||
+             (offsetWidth != 0 && offsetWidth != width)) {
+    PyErr_Format(PyExc_TypeError, "offsets must be a buffer of 4- or 8-byte integers, or of bytes with offsetWidth=4 or 8 (got '%s', itemsize %zd)",
+                 offsets.format == 0 ? "B" : offsets.format, offsets.itemsize);
+    goto done;
+  }
+  if (offsets.len % width != 0 || offsets.len < width) {
+    PyErr_SetString(PyExc_ValueError, "offsets must hold at least one offset, and whole offsets");
+    goto done;
+  }
+  count = offsets.len / width - 1;
+  if (count > INT_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "too many rows");
+    goto done;
+  }
+
+  if (!GetColumnBuffer(langsArg, "outLanguages", true, 2, "hH", &langs)) {
+    goto done;
+  }
+  hasLangs = true;
+  if (percentsArg != Py_None) {
+    if (!GetColumnBuffer(percentsArg, "outPercents", true, 1, "bB", &percents)) {
+      goto done;
+    }
+    hasPercents = true;
+  }
+  if (reliableArg != Py_None) {
+    if (!GetColumnBuffer(reliableArg, "outReliable", true, 1, "bB", &reliable)) {
+      goto done;
+    }
+    hasReliable = true;
+  }
+  if (langs.len / 2 < count || (hasPercents && percents.len < count) || (hasReliable && reliable.len < count)) {
+    PyErr_Format(PyExc_ValueError, "outLanguages, outPercents and outReliable must each hold at least %zd items, one per row", count);
+    goto done;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  const char *offsetBytes = (const char *) offsets.buf;
+  badRow = width == 4 ?
+    CheckColumnOffsets<int32_t>(offsetBytes, count, data.len) :
+    CheckColumnOffsets<int64_t>(offsetBytes, count, data.len);
+  if (badRow == -1) {
+    if (width == 4) {
+      DetectColumn<int32_t>((const char *) data.buf, offsetBytes, (int) count, opts, threads,
+                            (unsigned short *) langs.buf,
+                            hasPercents ? (unsigned char *) percents.buf : 0,
+                            hasReliable ? (signed char *) reliable.buf : 0);
+    } else {
+      DetectColumn<int64_t>((const char *) data.buf, offsetBytes, (int) count, opts, threads,
+                            (unsigned short *) langs.buf,
+                            hasPercents ? (unsigned char *) percents.buf : 0,
+                            hasReliable ? (signed char *) reliable.buf : 0);
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  if (badRow != -1) {
+    PyErr_Format(PyExc_ValueError, "offsets of row %zd are out of order or outside data (%zd bytes)", badRow, data.len);
+    goto done;
+  }
+  result = PyLong_FromSsize_t(count);
+
+ done:
+  if (hasData) {
+    PyBuffer_Release(&data);
+  }
+  if (hasOffsets) {
+    PyBuffer_Release(&offsets);
+  }
+  if (hasLangs) {
+    PyBuffer_Release(&langs);
+  }
+  if (hasPercents) {
+    PyBuffer_Release(&percents);
+  }
+  if (hasReliable) {
+    PyBuffer_Release(&reliable);
+  }
+  return result;
+}
+
+#ifdef IS_PY3K
+
+// detect_async() runs each job on the worker pool, away from Python.
+// A finished job is queued on its event loop's AsyncCompletions, which
+// wakes the loop by writing a byte to a pipe the loop watches with
+// add_reader; the loop then builds the results and completes the
+// futures itself.  So no Python thread waits per request, and worker
+// threads never take the GIL.
+
+struct AsyncJob {
+  AsyncCompletions *completions;
+  PyObject *future;
+  InputBytes in;
+  DetectOptions opts;
+  // Copies of the hint strings in opts, which must outlive the caller's
+  // arguments:
+  std::string tldHint;
+  std::string contentLanguageHint;
+  DetectResult result;
+};
+
+struct AsyncCompletions {
+  // Holds the module, so its state outlives the jobs:
+  PyObject *module;
+  PyObject *loop;
+  int readFd;
+  int writeFd;
+  // Guards pending, done, and the write to writeFd, so the pipe is never
+  // written after the loop has taken the last job and closed it:
+  std::mutex mu;
+  // Jobs submitted and not yet handed back to the loop:
+  size_t pending;
+  std::vector<AsyncJob *> done;
+};
+
+static void
+RunAsyncJob(AsyncJob *job) {
+  uint64_t t0 = StatsNow();
+  DetectOne(job->in.bytes, job->in.numBytes, job->opts, &job->result);
+  StatsAddCall(StatsNow() - t0);
+  StatsAddBytes(job->in.numBytes);
+  if (job->result.validPrefixBytes < job->in.numBytes) {
+    StatsAddInvalid();
+  } else {
+    StatsAddResult(job->result);
+  }
+
+  AsyncCompletions *c = job->completions;
+  std::lock_guard<std::mutex> lock(c->mu);
+  c->done.push_back(job);
+  if (c->done.size() == 1) {
+    // If the pipe is full, a wakeup is already pending:
+    char byte = 0;
+    ssize_t ignored = write(c->writeFd, &byte, 1);
+    (void) ignored;
+  }
+}
+
+static void
+FreeAsyncJob(AsyncJob *job) {
+  ReleaseInputBytes(&job->in);
+  Py_DECREF(job->future);
+  delete job;
+}
+
+// Sets the job's future to its result or exception, unless it was
+// cancelled, and frees the job:
+static void
+CompleteAsyncJob(struct PYCLDState *st, AsyncJob *job) {
+  PyObject *done = PyObject_CallMethod(job->future, (char *) "done", 0);
+  int isDone = done == 0 ? -1 : PyObject_IsTrue(done);
+  Py_XDECREF(done);
+
+  PyObject *ret = 0;
+  if (isDone == 0) {
+    const DetectResult &r = job->result;
+    PyObject *result = 0;
+    if (r.validPrefixBytes < job->in.numBytes) {
+      SetInputError(st->error, "input", job->opts, r, job->in.numBytes);
+    } else {
+      result = BuildResult(st, job->opts, r);
+    }
+    // The result is a tuple, so it is passed inside one:
+    if (result != 0) {
+      ret = PyObject_CallMethod(job->future, (char *) "set_result", (char *) "(O)", result);
+      Py_DECREF(result);
+    } else {
+      PyObject *type, *value, *traceback;
+      PyErr_Fetch(&type, &value, &traceback);
+      PyErr_NormalizeException(&type, &value, &traceback);
+      ret = PyObject_CallMethod(job->future, (char *) "set_exception", (char *) "(O)", value);
+      Py_XDECREF(type);
+      Py_XDECREF(value);
+      Py_XDECREF(traceback);
+    }
+  } else if (isDone == 1) {
+    ret = Py_None;
+    Py_INCREF(ret);
+  }
+  if (ret == 0) {
+    PyErr_WriteUnraisable(job->future);
+  }
+  Py_XDECREF(ret);
+  FreeAsyncJob(job);
+}
+
+// Frees c, which must no longer be in st->asyncCompletions:
+static void
+CloseAsyncCompletions(AsyncCompletions *c) {
+  close(c->readFd);
+  close(c->writeFd);
+  Py_DECREF(c->loop);
+  Py_DECREF(c->module);
+  delete c;
+}
+
+// The loop's reader callback; self is a capsule holding the
+// AsyncCompletions:
+static PyObject *
+AsyncCompletions_drain(PyObject *self, PyObject *unused) {
+  AsyncCompletions *c = (AsyncCompletions *) PyCapsule_GetPointer(self, 0);
+  if (c == 0) {
+    return 0;
+  }
+
+  char buffer[64];
+  while (read(c->readFd, buffer, sizeof(buffer)) > 0) {
+  }
+  std::vector<AsyncJob *> jobs;
+  {
+    std::lock_guard<std::mutex> lock(c->mu);
+    jobs.swap(c->done);
+  }
+
+  struct PYCLDState *st = GETSTATE(c->module);
+  for(size_t i=0;i<jobs.size();i++) {
+    CompleteAsyncJob(st, jobs[i]);
+  }
+  size_t pending;
+  {
+    std::lock_guard<std::mutex> lock(c->mu);
+    c->pending -= jobs.size();
+    pending = c->pending;
+  }
+
+  // Only this loop's thread submits jobs to it, so none can arrive now:
+  if (pending == 0) {
+    PyObject *ret = PyObject_CallMethod(c->loop, (char *) "remove_reader", (char *) "i", c->readFd);
+    if (ret == 0) {
+      PyErr_WriteUnraisable(c->loop);
+    }
+    Py_XDECREF(ret);
+    {
+      std::lock_guard<std::mutex> lock(*st->asyncMu);
+      st->asyncCompletions->erase(c->loop);
+    }
+    CloseAsyncCompletions(c);
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef AsyncCompletions_drainDef = {
+  "_drain", (PyCFunction) AsyncCompletions_drain, METH_NOARGS, 0
+};
+
+// Frees the completions of loops that were closed with jobs pending,
+// once those jobs have finished; their futures can no longer complete.
+// No Python code runs with asyncMu held, so a thread waiting for it
+// never blocks one that is running Python:
+static void
+SweepClosedLoops(struct PYCLDState *st) {
+  std::vector<PyObject *> loops;
+  {
+    std::lock_guard<std::mutex> lock(*st->asyncMu);
+    for(auto it=st->asyncCompletions->begin();it!=st->asyncCompletions->end();++it) {
+      Py_INCREF(it->first);
+      loops.push_back(it->first);
+    }
+  }
+  for(size_t i=0;i<loops.size();i++) {
+    PyObject *loop = loops[i];
+    PyObject *isClosed = PyObject_CallMethod(loop, (char *) "is_closed", 0);
+    if (isClosed == 0) {
+      PyErr_Clear();
+    }
+    AsyncCompletions *c = 0;
+    if (isClosed == Py_True) {
+      std::lock_guard<std::mutex> lock(*st->asyncMu);
+      auto it = st->asyncCompletions->find(loop);
+      if (it != st->asyncCompletions->end()) {
+        std::lock_guard<std::mutex> jobsLock(it->second->mu);
+        // Unless some jobs are still running:
+        if (it->second->done.size() == it->second->pending) {
+          c = it->second;
+          st->asyncCompletions->erase(it);
+        }
+      }
+    }
+    Py_XDECREF(isClosed);
+    Py_DECREF(loop);
+    if (c != 0) {
+      for(size_t j=0;j<c->done.size();j++) {
+        FreeAsyncJob(c->done[j]);
+      }
+      CloseAsyncCompletions(c);
+    }
+  }
+}
+
+// Returns loop's AsyncCompletions (borrowed), registering its reader
+// on first use, or 0 with an exception set:
+static AsyncCompletions *
+GetAsyncCompletions(PyObject *module, PyObject *loop) {
+  struct PYCLDState *st = GETSTATE(module);
+  {
+    std::lock_guard<std::mutex> lock(*st->asyncMu);
+    auto it = st->asyncCompletions->find(loop);
+    if (it != st->asyncCompletions->end()) {
+      return it->second;
+    }
+  }
+  SweepClosedLoops(st);
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    return 0;
+  }
+  for(int i=0;i<2;i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  AsyncCompletions *c = new AsyncCompletions();
+  c->module = module;
+  Py_INCREF(module);
+  c->loop = loop;
+  Py_INCREF(loop);
+  c->readFd = fds[0];
+  c->writeFd = fds[1];
+  c->pending = 0;
+
+  PyObject *capsule = PyCapsule_New(c, 0, 0);
+  PyObject *drain = capsule == 0 ? 0 : PyCFunction_New(&AsyncCompletions_drainDef, capsule);
+  Py_XDECREF(capsule);
+  PyObject *ret = drain == 0 ? 0 : PyObject_CallMethod(loop, (char *) "add_reader", (char *) "iO", c->readFd, drain);
+  Py_XDECREF(drain);
+  if (ret == 0) {
+    CloseAsyncCompletions(c);
+    return 0;
+  }
+  Py_DECREF(ret);
+  std::lock_guard<std::mutex> lock(*st->asyncMu);
+  (*st->asyncCompletions)[loop] = c;
+  return c;
+}
+
+static PyObject *
+detect_async(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *utf8Bytes;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"utf8Bytes",
+                                 "isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "returnVectors",
+                                 "debugScoreAsQuads",
+                                 "debugHTML",
+                                 "debugCR",
+                                 "debugVerbose",
+                                 "debugQuiet",
+                                 "debugEcho",
+                                 "bestEffort",
+                                 "hints",
+                                 "columnarVectors",
+                                 "maxBytes",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 "encoding",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|izzzziiiiiiiiO!iizzOz",
+                                   (char **) kwList,
+                                   &utf8Bytes,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.returnVectors,
+                                   &a.flagScoreAsQuads,
+                                   &a.flagHTML,
+                                   &a.flagCR,
+                                   &a.flagVerbose,
+                                   &a.flagQuiet,
+                                   &a.flagEcho,
+                                   &a.flagBestEffort,
+                                   GETSTATE(self)->hintsType, &a.hints,
+                                   &a.columnarVectors,
+                                   &a.maxBytes,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages,
+                                   &a.encoding)) {
+    return 0;
+  }
+
+  struct PYCLDState *st = GETSTATE(self);
+  DetectOptions opts;
+  if (!ResolveDetectArgs(st->error, a, &opts)) {
+    return 0;
+  }
+
+  PyObject *getRunningLoop = st->getRunningLoop.load();
+  if (getRunningLoop == 0) {
+    PyObject *asyncio = PyImport_ImportModule("asyncio");
+    if (asyncio == 0) {
+      return 0;
+    }
+    getRunningLoop = PyObject_GetAttrString(asyncio, "get_running_loop");
+    Py_DECREF(asyncio);
+    if (getRunningLoop == 0) {
+      return 0;
+    }
+    PyObject *expected = 0;
+    if (!st->getRunningLoop.compare_exchange_strong(expected, getRunningLoop)) {
+      // Another thread got there first:
+      Py_DECREF(getRunningLoop);
+      getRunningLoop = expected;
+    }
+  }
+  // Raises RuntimeError outside a coroutine:
+  PyObject *loop = PyObject_CallObject(getRunningLoop, 0);
+  if (loop == 0) {
+    return 0;
+  }
+
+  AsyncJob *job = new AsyncJob();
+  job->opts = opts;
+  if (opts.cldHints.tld_hint != 0) {
+    job->tldHint = opts.cldHints.tld_hint;
+    job->opts.cldHints.tld_hint = job->tldHint.c_str();
+  }
+  if (opts.cldHints.content_language_hint != 0) {
+    job->contentLanguageHint = opts.cldHints.content_language_hint;
+    job->opts.cldHints.content_language_hint = job->contentLanguageHint.c_str();
+  }
+
+  if (!GetInputBytes(utf8Bytes, &job->in)) {
+    delete job;
+    Py_DECREF(loop);
+    return 0;
+  }
+  job->future = PyObject_CallMethod(loop, (char *) "create_future", 0);
+  job->completions = job->future == 0 ? 0 : GetAsyncCompletions(self, loop);
+  Py_DECREF(loop);
+  if (job->completions == 0) {
+    ReleaseInputBytes(&job->in);
+    Py_XDECREF(job->future);
+    delete job;
+    return 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(job->completions->mu);
+    job->completions->pending++;
+  }
+  Py_INCREF(job->future);
+  PyObject *future = job->future;
+  GetWorkerPool()->Submit([job]() {
+      RunAsyncJob(job);
+    });
+  return future;
+}
+
+#endif  // IS_PY3K
+
+typedef struct {
+  PyObject_HEAD
+  StreamDetector *stream;
+  // Set while a call runs, so a second thread cannot use the same
+  // Detector at the same time, with or without a GIL:
+  std::atomic<bool> busy;
+  // Time feed() has spent on the document so far; the whole document
+  // counts as one call in the stats, when it is finished or rejected:
+  uint64_t feedNanos;
+#ifdef PYCLD_VECTORCALL
+  vectorcallfunc vectorcall;
+#endif
+} DetectorObject;
+
+#ifdef PYCLD_VECTORCALL
+static PyObject *Detector_vectorcall(PyObject *self, PyObject *const *args, size_t nargsf, PyObject *kwNames);
+#endif
+
+static PyObject *
+Detector_new(PyTypeObject *type, PyObject *args, PyObject *kwArgs) {
+  DetectorObject *self = (DetectorObject *) type->tp_alloc(type, 0);
+  if (self != 0) {
+    self->stream = 0;
+    self->busy.store(false);
+    self->feedNanos = 0;
+#ifdef PYCLD_VECTORCALL
+    self->vectorcall = Detector_vectorcall;
+#endif
+  }
+  return (PyObject *) self;
+}
+
+static int
+Detector_init(DetectorObject *self, PyObject *args, PyObject *kwArgs) {
+  struct PYCLDState *st = GetTypeState(Py_TYPE(self));
+  int pieceBytes = 65536;
+
+  DetectArgs a;
+  InitDetectArgs(&a);
+
+  static const char *kwList[] = {"isPlainText",
+                                 "hintTopLevelDomain",
+                                 "hintLanguage",
+                                 "hintLanguageHTTPHeaders",
+                                 "hintEncoding",
+                                 "returnVectors",
+                                 "debugScoreAsQuads",
+                                 "debugHTML",
+                                 "debugCR",
+                                 "debugVerbose",
+                                 "debugQuiet",
+                                 "debugEcho",
+                                 "bestEffort",
+                                 "pieceBytes",
+                                 "hints",
+                                 "columnarVectors",
+                                 "tables",
+                                 "invalidUTF8",
+                                 "languages",
+                                 NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "|izzzziiiiiiiiiO!izzO",
+                                   (char **) kwList,
+                                   &a.isPlainText,
+                                   &a.hintTopLevelDomain,
+                                   &a.hintLanguage,
+                                   &a.hintLanguageHTTPHeaders,
+                                   &a.hintEncoding,
+                                   &a.returnVectors,
+                                   &a.flagScoreAsQuads,
+                                   &a.flagHTML,
+                                   &a.flagCR,
+                                   &a.flagVerbose,
+                                   &a.flagQuiet,
+                                   &a.flagEcho,
+                                   &a.flagBestEffort,
+                                   &pieceBytes,
+                                   st->hintsType, &a.hints,
+                                   &a.columnarVectors,
+                                   &a.tables,
+                                   &a.invalidUTF8,
+                                   &a.languages)) {
+    return -1;
+  }
+
+  if (pieceBytes < 64) {
+    PyErr_Format(PyExc_ValueError, "pieceBytes must be at least 64 (got %d)", pieceBytes);
+    return -1;
+  }
+
+  DetectOptions opts;
+  if (!ResolveDetectArgs(st->error, a, &opts)) {
+    return -1;
+  }
+
+  if (self->busy.exchange(true)) {
+    PyErr_SetString(PyExc_RuntimeError, "Detector is in use by another thread");
+    return -1;
+  }
+  delete self->stream;
+  self->stream = new StreamDetector(opts, pieceBytes);
+  self->feedNanos = 0;
+  self->busy.store(false);
+  return 0;
+}
+
+static void
+Detector_dealloc(DetectorObject *self) {
+  delete self->stream;
+  FreeObject((PyObject *) self);
+}
+
+// Returns false with an exception set if self cannot be used right now.
+// Until busy is cleared, __init__ cannot replace self->stream, so
+// results must be built from its options before then:
+static bool
+Detector_acquire(DetectorObject *self) {
+  if (self->busy.exchange(true)) {
+    PyErr_SetString(PyExc_RuntimeError, "Detector is in use by another thread");
+    return false;
+  }
+  if (self->stream == 0) {
+    self->busy.store(false);
+    PyErr_SetString(PyExc_RuntimeError, "Detector.__init__ was not called");
+    return false;
+  }
+  return true;
+}
+
+static PyObject *
+Detector_feed(DetectorObject *self, PyObject *arg) {
+  InputBytes in;
+  if (!GetInputBytes(arg, &in)) {
+    return 0;
+  }
+  if (!Detector_acquire(self)) {
+    ReleaseInputBytes(&in);
+    return 0;
+  }
+
+  bool ok;
+  int badOffset;
+
+  Py_BEGIN_ALLOW_THREADS
+  uint64_t t0 = StatsNow();
+  ok = self->stream->Feed(in.bytes, in.numBytes, &badOffset);
+  self->feedNanos += StatsNow() - t0;
+  StatsAddBytes(in.numBytes);
+  if (!ok) {
+    StatsAddCall(self->feedNanos);
+    StatsAddInvalid();
+    self->feedNanos = 0;
+  }
+  Py_END_ALLOW_THREADS
+
+  self->busy.store(false);
+  ReleaseInputBytes(&in);
+
+  if (!ok) {
+    PyErr_Format(GetTypeState(Py_TYPE(self))->error, "input contains invalid UTF-8 around byte %d; the Detector was reset", badOffset);
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+Detector_finish(DetectorObject *self) {
+  if (!Detector_acquire(self)) {
+    return 0;
+  }
+
+  bool ok;
+  int badOffset;
+  ScratchResult r;
+
+  Py_BEGIN_ALLOW_THREADS
+  uint64_t t0 = StatsNow();
+  ok = self->stream->Finish(&r, &badOffset);
+  StatsAddCall(self->feedNanos + StatsNow() - t0);
+  self->feedNanos = 0;
+  if (ok) {
+    StatsAddResult(r);
+  } else {
+    StatsAddInvalid();
+  }
+  Py_END_ALLOW_THREADS
+
+  if (!ok) {
+    self->busy.store(false);
+    PyErr_Format(GetTypeState(Py_TYPE(self))->error, "input contains invalid UTF-8 around byte %d; the Detector was reset", badOffset);
+    return 0;
+  }
+  PyObject *result = BuildResult(GetTypeState(Py_TYPE(self)), self->stream->options(), r);
+  self->busy.store(false);
+  return result;
+}
+
+static PyObject *
+Detector_reset(DetectorObject *self) {
+  if (!Detector_acquire(self)) {
+    return 0;
+  }
+  self->stream->Reset();
+  self->feedNanos = 0;
+  self->busy.store(false);
+  Py_RETURN_NONE;
+}
+
+// Detects text on its own with the Detector's options, leaving any
+// document being fed untouched, and returns a new reference to the
+// result shaped by build:
+static PyObject *
+Detector_detectWith(DetectorObject *self, PyObject *text,
+                    PyObject *(*build)(struct PYCLDState *st, const DetectOptions &opts, const DetectResult &r)) {
+  InputBytes in;
+  if (!GetInputBytes(text, &in)) {
+    return 0;
+  }
+  if (!Detector_acquire(self)) {
+    ReleaseInputBytes(&in);
+    return 0;
+  }
+
+  struct PYCLDState *st = GetTypeState(Py_TYPE(self));
+  const DetectOptions &opts = self->stream->options();
+  ScratchResult r;
+  bool ok = DetectInput(st, in, opts, &r);
+  PyObject *result = ok ? build(st, opts, r) : 0;
+
+  self->busy.store(false);
+  ReleaseInputBytes(&in);
+  return result;
+}
+
+static PyObject *
+BuildIdResult(struct PYCLDState *st, const DetectOptions &opts, const DetectResult &r) {
+  return BuildTopResult(st, r, false);
+}
+
+static PyObject *
+BuildCodeResult(struct PYCLDState *st, const DetectOptions &opts, const DetectResult &r) {
+  return BuildTopResult(st, r, true);
+}
+
+static PyObject *
+Detector_detect(DetectorObject *self, PyObject *text) {
+  return Detector_detectWith(self, text, BuildResult);
+}
+
+static PyObject *
+Detector_detect_id(DetectorObject *self, PyObject *text) {
+  return Detector_detectWith(self, text, BuildIdResult);
+}
+
+static PyObject *
+Detector_detect_code(DetectorObject *self, PyObject *text) {
+  return Detector_detectWith(self, text, BuildCodeResult);
+}
+
+#ifdef PYCLD_VECTORCALL
+
+// Detector.__call__, called with the arguments in place, so no tuple
+// or dict is built per call:
+static PyObject *
+Detector_vectorcall(PyObject *self, PyObject *const *args, size_t nargsf, PyObject *kwNames) {
+  if (PyVectorcall_NARGS(nargsf) != 1 || (kwNames != 0 && PyTuple_GET_SIZE(kwNames) != 0)) {
+    PyErr_SetString(PyExc_TypeError, "a Detector takes exactly one argument, the text to detect; options are fixed by Detector()");
+    return 0;
+  }
+  return Detector_detect((DetectorObject *) self, args[0]);
+}
+
+#else  // PYCLD_VECTORCALL
+
+static PyObject *
+Detector_call(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  if ((kwArgs != 0 && PyDict_Size(kwArgs) != 0) || PyTuple_GET_SIZE(args) != 1) {
+    PyErr_SetString(PyExc_TypeError, "a Detector takes exactly one argument, the text to detect; options are fixed by Detector()");
+    return 0;
+  }
+  return Detector_detect((DetectorObject *) self, PyTuple_GET_ITEM(args, 0));
+}
+
+#endif  // PYCLD_VECTORCALL
+
+static PyMethodDef Detector_methods[] = {
+  {"feed", (PyCFunction) Detector_feed, METH_O,
+   "feed(utf8Bytes): detect the next chunk of the document.  Takes the same\n"
+   "input types as detect(); a UTF-8 sequence may be split across chunks."},
+  {"finish", (PyCFunction) Detector_finish, METH_NOARGS,
+   "finish(): detect whatever is left and return the result for the whole\n"
+   "document, shaped exactly like detect()'s.  The Detector is then ready\n"
+   "for the next document."},
+  {"reset", (PyCFunction) Detector_reset, METH_NOARGS,
+   "reset(): discard everything fed so far."},
+  {"detect_id", (PyCFunction) Detector_detect_id, METH_O,
+   "detect_id(utf8Bytes): like calling the Detector, but return only\n"
+   "(languageId, isReliable), as cld2.detect_id() does."},
+  {"detect_code", (PyCFunction) Detector_detect_code, METH_O,
+   "detect_code(utf8Bytes): like calling the Detector, but return only\n"
+   "(languageCode, isReliable), as cld2.detect_code() does."},
+  {0, 0}        /* Sentinel */
+};
+
+const char *DETECTOR_DOC =
+  "Detector(**options): detects one document fed in chunks.\n\n"
+
+  "Text is detected in pieces of about pieceBytes (default 65536) as the\n"
+  "chunks arrive, so at most about one piece is held in memory at a time,\n"
+  "and per-language totals are kept across pieces.  Pieces end at\n"
+  "whitespace where possible.  Results of several pieces are merged by\n"
+  "weighting each language's percent and score by its text bytes in each\n"
+  "piece; isReliable is True if at least half of the text was in reliable\n"
+  "pieces.  A document that fits in one piece gets exactly detect()'s\n"
+  "result.\n\n"
+
+  "All other options are the keyword arguments of detect(), except\n"
+  "threads, maxBytes and encoding; chunks must be UTF-8.  Invalid\n"
+  "UTF-8 raises cld2.error from feed() or finish() and resets the\n"
+  "Detector.  One Detector may only be used by one thread at a time.\n\n"
+
+  "Calling a Detector, detector(utf8Bytes), detects that one text on its\n"
+  "own and returns exactly what detect(utf8Bytes, **options) would,\n"
+  "without touching the document being fed.  The options were checked\n"
+  "and resolved once, by Detector(), and the call takes no keyword\n"
+  "arguments (on Python 3.9+ it is a vectorcall), so nothing but the\n"
+  "text is parsed per call: the fastest way to detect many short texts\n"
+  "with the same options.";
+
+#ifdef PYCLD_MULTI_PHASE
+
+static PyMemberDef Detector_members[] = {
+  {(char *) "__vectorcalloffset__", T_PYSSIZET, offsetof(DetectorObject, vectorcall), READONLY, 0},
+  {0}
+};
+
+static PyType_Slot Detector_slots[] = {
+  {Py_tp_dealloc, (void *) Detector_dealloc},
+  {Py_tp_doc, (void *) DETECTOR_DOC},
+  {Py_tp_methods, (void *) Detector_methods},
+  {Py_tp_members, (void *) Detector_members},
+  {Py_tp_call, (void *) PyVectorcall_Call},
+  {Py_tp_init, (void *) Detector_init},
+  {Py_tp_new, (void *) Detector_new},
+  {0, 0}
+};
+
+static PyType_Spec Detector_spec = {
+#ifdef CLD2_FULL
+  "cld2full.Detector",
+#else
+  "cld2.Detector",
+#endif
+  sizeof(DetectorObject),
+  0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_HAVE_VECTORCALL,
+  Detector_slots
+};
+
+#else  // PYCLD_MULTI_PHASE
+
+static PyTypeObject DetectorType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+#ifdef CLD2_FULL
+  "cld2full.Detector",                /* tp_name */
+#else
+  "cld2.Detector",                    /* tp_name */
+#endif
+  sizeof(DetectorObject),             /* tp_basicsize */
+  0,                                  /* tp_itemsize */
+  (destructor) Detector_dealloc,      /* tp_dealloc */
+#ifdef PYCLD_VECTORCALL
+  offsetof(DetectorObject, vectorcall), /* tp_vectorcall_offset */
+#else
+  0,                                  /* tp_print */
+#endif
+  0,                                  /* tp_getattr */
+  0,                                  /* tp_setattr */
+  0,                                  /* tp_compare */
+  0,                                  /* tp_repr */
+  0,                                  /* tp_as_number */
+  0,                                  /* tp_as_sequence */
+  0,                                  /* tp_as_mapping */
+  0,                                  /* tp_hash */
+#ifdef PYCLD_VECTORCALL
+  PyVectorcall_Call,                  /* tp_call */
+#else
+  Detector_call,                      /* tp_call */
+#endif
+  0,                                  /* tp_str */
+  0,                                  /* tp_getattro */
+  0,                                  /* tp_setattro */
+  0,                                  /* tp_as_buffer */
+#ifdef PYCLD_VECTORCALL
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_VECTORCALL, /* tp_flags */
+#else
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
+#endif
+  DETECTOR_DOC,                       /* tp_doc */
+  0,                                  /* tp_traverse */
+  0,                                  /* tp_clear */
+  0,                                  /* tp_richcompare */
+  0,                                  /* tp_weaklistoffset */
+  0,                                  /* tp_iter */
+  0,                                  /* tp_iternext */
+  Detector_methods,                   /* tp_methods */
+  0,                                  /* tp_members */
+  0,                                  /* tp_getset */
+  0,                                  /* tp_base */
+  0,                                  /* tp_dict */
+  0,                                  /* tp_descr_get */
+  0,                                  /* tp_descr_set */
+  0,                                  /* tp_dictoffset */
+  (initproc) Detector_init,           /* tp_init */
+  0,                                  /* tp_alloc */
+  Detector_new,                       /* tp_new */
+};
+
+#endif  // PYCLD_MULTI_PHASE
+
+const char *DOC =
+  "Detect language(s) from a UTF8 string.\n\n"
+
+  "Arguments:\n\n"
+  "  utf8Bytes: The text to detect, encoded as UTF-8 bytes (required).  If\n"
+  "             this is not valid UTF-8, then an cld2.error is raised.\n"
+  "             Any object supporting the buffer protocol (bytes,\n"
+  "             bytearray, memoryview, mmap, ...) is read in place without\n"
+  "             copying; a str is read through its cached UTF-8 form.\n\n"
+
+  "  isPlainText: If False, then the input is HTML and CLD will skip HTML tags,\n"
+  "               expand HTML entities, detect HTML <lang ...> tags, etc.\n\n"
+
+  "  hintTopLevelDomain: E.g., 'id' boosts Indonesian\n\n"
+
+  "  hintLanguage: E.g., 'ITALIAN' or 'it' boosts Italian; see cld.LANGUAGES\n"
+  "                for all known language\n\n"
+
+  "  hintLanguageHTTPHeaders: E.g., 'mi,en' boosts Maori and English\n\n"
+
+  "  hintEncoding: E.g, 'SJS' boosts Japanese; see cld.ENCODINGS for all known\n"
+  "                encodings\n\n"
+
+  "  columnarVectors: If True then return the vectors (implies\n"
+  "                   returnVectors) as a cld2.ChunkVectors of three\n"
+  "                   parallel array.arrays, offsets ('i'), lengths ('H')\n"
+  "                   and languages ('H', ids into LANGUAGES_BY_ID), instead\n"
+  "                   of one tuple per vector.  They support the buffer\n"
+  "                   protocol, e.g. numpy.frombuffer(vectors.offsets,\n"
+  "                   numpy.int32), and cost no Python object per vector.\n\n"
+
+  "  hints: A cld2.Hints holding all four hints above, already checked and\n"
+  "         resolved; faster when the same hints are used many times.\n\n"
+
+  "  encoding: A name from cld2.ENCODINGS (e.g. 'JAPANESE_SHIFT_JIS',\n"
+  "            'CHINESE_GB', 'MSFT_CP1252'): utf8Bytes is raw bytes in\n"
+  "            that encoding, and is converted to UTF-8 natively (with\n"
+  "            iconv, into a buffer reused per thread) with the GIL\n"
+  "            released, instead of being decoded and re-encoded in\n"
+  "            Python.  It is also the hintEncoding unless one is given.\n"
+  "            invalidUTF8 then applies to bytes invalid in this\n"
+  "            encoding, and control characters CLD2 rejects are\n"
+  "            dropped from the converted text.  Byte offsets and counts\n"
+  "            in the result refer to the converted UTF-8 text.\n"
+  "            Encodings iconv cannot read raise ValueError.\n\n"
+
+  "  languages: Language names or codes (e.g. ['en', 'FRENCH']); if\n"
+  "             given, only these languages are reported.  Others are\n"
+  "             dropped from details, which Unknown then pads, and their\n"
+  "             vectors are labelled Unknown; percent and score still\n"
+  "             refer to the whole text, and isReliable is False when\n"
+  "             the text's top language is not one of them.  CLD2\n"
+  "             itself still scores every language its tables have, so\n"
+  "             this narrows the answer, not the work.  Applied to each\n"
+  "             piece Detector, threads or maxBytes detect.\n\n"
+
+  "  invalidUTF8: What to do if utf8Bytes is not valid UTF-8: 'error'\n"
+  "               (the default) raises cld2.error; 'replace' replaces\n"
+  "               each invalid sequence with U+FFFD and 'skip' drops it,\n"
+  "               natively, and then detects the repaired text.  Control\n"
+  "               characters (other than whitespace) and noncharacters,\n"
+  "               which CLD2 rejects too, count as invalid.  Byte offsets\n"
+  "               and counts in the result then refer to the repaired\n"
+  "               text.\n\n"
+
+  "  threads: If not 1 (the default), a long text (128 KB or more) is\n"
+  "           split into pieces on whitespace and detected on up to this\n"
+  "           many native threads, 0 meaning one per CPU.  The pieces'\n"
+  "           results are merged as Detector merges them, weighting each\n"
+  "           language by its text bytes per piece, with vectors offset\n"
+  "           to their place in the whole text; the result can differ\n"
+  "           slightly from detecting the text in one piece.\n\n"
+
+  "  tables: 'small' (83 languages, as cld2) or 'full' (163 languages, as\n"
+  "          cld2full); the default is this module's own, cld2.TABLES.\n"
+  "          The other set's library is loaded the first time it is\n"
+  "          asked for; see DETECTED_LANGUAGES_BY_TABLES for what each\n"
+  "          detects.\n\n"
+
+  "  maxBytes: If more than 0 (the default is 0) and the text is longer,\n"
+  "            bound the work by scoring only about this many bytes of\n"
+  "            it: windows from the head, tail and middle, each cut on\n"
+  "            whitespace or a character boundary, stopping early when\n"
+  "            the head and tail reliably agree.  percent and\n"
+  "            textBytesFound then describe the scored windows only,\n"
+  "            vectors only cover them, and invalid UTF-8 outside them\n"
+  "            is not noticed.  bytesScored in the result says how many\n"
+  "            bytes were scored.\n\n"
+
+  "  returnVectors: If True then the vectors indicating which language was\n"
+  "                 detected in which byte range are returned in addition to\n"
+  "                 details.  The vectors are a sequence of (bytesOffset,\n"
+  "                 bytesLength, languageName, languageCode), in order.\n"
+  "                 bytesOffset is the start of the vector, bytesLength\n"
+  "                 is the length of the vector.  Note that there is some\n"
+  "                 added CPU cost if this is True.\n\n"
+
+  "  debugScoreAsQuads: Normally, several languages are detected solely by their\n"
+  "                     Unicode script.  Combined with appropritate lookup tables,\n"
+  "                     this flag forces them instead to be detected via quadgrams.\n"
+  "                     This can be a useful refinement when looking for meaningful\n"
+  "                     text in these languages, instead of just character sets.\n"
+  "                     The default tables do not support this use.\n\n"
+
+  "  debugHTML: For each detection call, write an HTML file to stderr, showing the\n"
+  "             text chunks and their detected languages.  See\n"
+  "             docs/InterpretingCLD2UnitTestOutput.pdf to interpret this output.\n"
+  "             To see the same in production, use traceEvery instead.\n\n"
+
+  "  traceEvery: If more than 0 (the default is 0), one call\n"
+  "              in this many on each thread, from a random start, is\n"
+  "              traced: its result's trace field is then a cld2.Trace\n"
+  "              (seconds, passes), recorded in memory rather than\n"
+  "              written to stderr.  passes has a cld2.TracePass (offset,\n"
+  "              bytes, seconds, chunks) per call into CLD2 (one per\n"
+  "              maxBytes window, say), and chunks a cld2.TraceChunk\n"
+  "              (offset, bytes, script, languageCode, candidates) per\n"
+  "              chunk it scored, script being the ISO 15924 code of the\n"
+  "              script CLD2 finds most of in the chunk and candidates\n"
+  "              the three LanguageDetails CLD2 gives that chunk's text\n"
+  "              alone.  Traced calls skip the result cache and use one\n"
+  "              thread; untraced ones cost nothing extra.\n\n"
+
+  "  bestEffort: If True then allow low-quality results for short text,\n"
+  "              rather than forcing the result to UNKNOWN_LANGUAGE.  This\n"
+  "              may be of use for those desiring approximate results on\n"
+  "              short input text, but there is no claim that these result\n"
+  "              are very good.\n\n"
+
+  "  debugCR: In that HTML file, force a new line for each chunk.\n\n"
+
+  "  debugVerbose: In that HTML file, show every lookup entry.\n\n"
+
+  "  debugQuiet: In that HTML file, suppress most of the output detail.\n\n"
+
+  "  debugEcho: Echo every input buffer to stderr.\n\n\n"
+
+  "Returns:\n\n"
+  "  isReliable, textBytesFound, details when returnVectors is False\n"
+  "  isReliable, textBytesFound, details, vectors when returnVectors is True\n\n"
+
+  "  The result is a cld2.DetectionResult (or DetectionResultWithVectors),\n"
+  "  a tuple whose items can also be read by those names.\n\n"
+
+  "  isReliable (boolean) is True if the detection is high confidence\n\n"
+
+  "  textBytesFound (int) is the total number of bytes of text detected\n\n"
+
+  "  bytesScored (int, by name only) is how many input bytes were scored:\n"
+  "  all of them unless maxBytes sampled the text\n\n"
+
+  "  trace (by name only) is a cld2.Trace if traceEvery picked this\n"
+  "  call, else None\n\n"
+
+  "  details is a tuple of up to three detected languages, where each is\n"
+  "  a cld2.LanguageDetail tuple (languageName, languageCode, percent,\n"
+  "  score).  percent is what percentage of the original text was\n"
+  "  detected as this language and score is the confidence score for that\n"
+  "  language."
+  ;
+
+const char *ID_DOC =
+  "detect_id(utf8Bytes, **options): return only (languageId, isReliable)\n"
+  "for the text's top language.\n\n"
+
+  "languageId is an int index into cld2.LANGUAGES_BY_ID, which maps it to\n"
+  "(languageName, languageCode); 26 is Unknown.  Every possible result\n"
+  "tuple is made when the module is imported, so no details, names or\n"
+  "scores are built and the call allocates nothing once a str's UTF-8\n"
+  "form is cached.  Invalid input raises cld2.error as in detect().\n\n"
+
+  "The options are those of detect_file(), except threads and the\n"
+  "record arguments.  With fixed options, Detector(**options).detect_id\n"
+  "skips the keyword parsing too.";
+
+const char *CODE_DOC =
+  "detect_code(utf8Bytes, **options): as detect_id(), but return\n"
+  "(languageCode, isReliable), the code being the same interned str\n"
+  "detect() reports (e.g. 'en', or 'un' for Unknown).";
+
+const char *BATCH_DOC =
+  "Detect language(s) for each item of a sequence of UTF8 strings.\n\n"
+
+  "The inputs are collected and the results built while holding the GIL;\n"
+  "all detection in between runs on a pool of native threads with the GIL\n"
+  "released, so one call can use every core.\n\n"
+
+  "Arguments:\n\n"
+  "  sequence: The texts to detect (required), each anything detect()\n"
+  "            accepts for utf8Bytes.  If any is not valid UTF-8, then\n"
+  "            cld2.error is raised.\n\n"
+
+  "  threads: Maximum number of native threads to use, including the\n"
+  "           calling thread.  0 (the default) uses one per CPU.\n\n"
+
+  "  traceEvery: As for detect(), counting items rather than calls.\n\n"
+
+  "  All other arguments are as for detect() and apply to every item.\n\n"
+
+  "Returns:\n\n"
+  "  A list with one result per input, in order, each exactly what\n"
+  "  detect() would return for that input."
+  ;
+
+const char *FILE_DOC =
+  "Detect the language of every record in a file.\n\n"
+
+  "The file is memory-mapped, split into records and detected on a pool\n"
+  "of native threads, all with the GIL released; no Python object is\n"
+  "created per record.\n\n"
+
+  "Arguments:\n\n"
+  "  path: The file to read (required).\n\n"
+
+  "  delimiter: Bytes that end each record (default b'\\n').  A last\n"
+  "             record without a delimiter is detected too.  Note that\n"
+  "             the delimiter itself is not part of the record; \\r is\n"
+  "             kept unless it is part of the delimiter.\n\n"
+
+  "  lengthPrefix: If not 0, ignore delimiter and read records as an\n"
+  "                unsigned little-endian length of this many bytes (1, 2,\n"
+  "                4 or 8) followed by that many bytes of text.\n\n"
+
+  "  threads: Maximum number of native threads to use, including the\n"
+  "           calling thread.  0 (the default) uses one per CPU.\n\n"
+
+  "  isPlainText, hintTopLevelDomain, hintLanguage,\n"
+  "  hintLanguageHTTPHeaders, hintEncoding, hints, bestEffort, maxBytes,\n"
+  "  tables, invalidUTF8, languages, encoding: As for detect(), applied\n"
+  "  to every record.  With encoding, the delimiter is matched in the raw\n"
+  "  bytes.\n\n"
+
+  "Returns:\n\n"
+  "  languages, percents, reliable: three array.arrays with one entry per\n"
+  "  record, in file order.  languages ('H') holds the top language id,\n"
+  "  an index into cld2.LANGUAGES_BY_ID; percents ('B') is that language's\n"
+  "  percent; reliable ('b') is 1 if the detection is reliable, 0 if not\n"
+  "  and -1 if the record is not valid UTF-8 (its language is then\n"
+  "  Unknown)."
+  ;
+
+const char *COLUMN_DOC =
+  "detect_column(data, offsets, outLanguages, outPercents=None,\n"
+  "              outReliable=None, **options): detect every row of an\n"
+  "Arrow-style string column into caller-provided arrays.\n\n"
+
+  "The column is one buffer of UTF-8 data plus offsets, as in Arrow's\n"
+  "string (int32 offsets) and large_string (int64 offsets) arrays: row i\n"
+  "is data[offsets[i]:offsets[i+1]], so there is one more offset than\n"
+  "rows.  Every argument is read or written in place through the buffer\n"
+  "protocol, so pyarrow is not needed and no Python object is created per\n"
+  "row; the rows are detected on a pool of native threads with the GIL\n"
+  "released.  Null rows should have empty extents (Arrow's do) and come\n"
+  "out Unknown.\n\n"
+
+  "Arguments:\n\n"
+  "  data: The UTF-8 bytes of all rows, e.g. arr.buffers()[2] of a\n"
+  "        pyarrow string array.\n\n"
+
+  "  offsets: The row offsets into data, as 4- or 8-byte integers\n"
+  "           (array('i'), numpy int32/int64, ...), or as raw bytes\n"
+  "           (e.g. arr.buffers()[1]) with offsetWidth=4 or 8.  Slice\n"
+  "           them to detect part of a column.\n\n"
+
+  "  outLanguages: Written with each row's top language id, an index\n"
+  "                into cld2.LANGUAGES_BY_ID; a writable buffer of\n"
+  "                2-byte integers (array('H'), numpy uint16, ...).\n\n"
+
+  "  outPercents: If given, written with that language's percent; a\n"
+  "               writable buffer of bytes (array('B'), numpy uint8,\n"
+  "               ...).\n\n"
+
+  "  outReliable: If given, written with 1 if the row's detection is\n"
+  "               reliable, 0 if not and -1 if the row is not valid\n"
+  "               UTF-8 (its language is then Unknown); a writable\n"
+  "               buffer of bytes (array('b'), numpy int8, ...).\n\n"
+
+  "  threads: Maximum number of native threads to use, including the\n"
+  "           calling thread.  0 (the default) uses one per CPU.\n\n"
+
+  "  isPlainText, hintTopLevelDomain, hintLanguage,\n"
+  "  hintLanguageHTTPHeaders, hintEncoding, hints, bestEffort, maxBytes,\n"
+  "  tables, invalidUTF8, languages, encoding: As for detect(), applied\n"
+  "  to every row.\n\n"
+
+  "Returns:\n\n"
+  "  The number of rows detected.  Offsets that go backwards or past the\n"
+  "  end of data raise ValueError before anything is written.";
+
+const char *ASYNC_DOC =
+  "detect_async(utf8Bytes, **options): detect on the module's native\n"
+  "threads and return an asyncio.Future for the result.\n\n"
+
+  "Call it from a coroutine and await the future; the result, or the\n"
+  "cld2.error for invalid UTF-8, is exactly detect()'s.  The input is\n"
+  "held (not copied) and detected on the worker pool with no Python\n"
+  "thread waiting on it.  Finished detections wake the event loop\n"
+  "through a pipe it watches, so any number can be in flight, and the\n"
+  "loop builds each result when it next runs.  Cancelling the future\n"
+  "does not stop a detection already running.\n\n"
+
+  "The options are the keyword arguments of detect(), except threads.";
+
+// Sets dict[name] = value; steals the ref to value, which may be 0 if
+// creating it failed:
+static bool
+SetStatsItem(PyObject *dict, const char *name, PyObject *value) {
+  if (value == 0) {
+    return false;
+  }
+  int ret = PyDict_SetItemString(dict, name, value);
+  Py_DECREF(value);
+  return ret == 0;
+}
+
+static PyObject *
+BuildStatsHistogram(const Stats &stats) {
+  PyObject *histogram = PyTuple_New(kStatsTimeBuckets);
+  if (histogram == 0) {
+    return 0;
+  }
+  for(int i=0;i<kStatsTimeBuckets;i++) {
+    double upperBound = i == kStatsTimeBuckets - 1 ? Py_HUGE_VAL : (double) (1 << i) / 1e6;
+    PyObject *item = Py_BuildValue("(dK)", upperBound, (unsigned long long) stats.timeHistogram[i]);
+    if (item == 0) {
+      Py_DECREF(histogram);
+      return 0;
+    }
+    // Steals ref:
+    PyTuple_SET_ITEM(histogram, i, item);
+  }
+  return histogram;
+}
+
+static PyObject *
+BuildStatsLanguages(struct PYCLDState *st, const Stats &stats) {
+  PyObject *languages = PyDict_New();
+  if (languages == 0) {
+    return 0;
+  }
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    if (stats.languages[i] == 0) {
+      continue;
+    }
+    // A few languages share a code; their counts are summed:
+    PyObject *code = LanguageCodeObject(st, i);
+    unsigned long long count = stats.languages[i];
+    PyObject *prev = PyDict_GetItem(languages, code);
+    if (prev != 0) {
+      count += PyLong_AsUnsignedLongLong(prev);
+    }
+    PyObject *pyCount = PyLong_FromUnsignedLongLong(count);
+    if (pyCount == 0 || PyDict_SetItem(languages, code, pyCount) != 0) {
+      Py_XDECREF(pyCount);
+      Py_DECREF(languages);
+      return 0;
+    }
+    Py_DECREF(pyCount);
+  }
+  return languages;
+}
+
+static PyObject *
+stats(PyObject *self) {
+  Stats snapshot;
+  StatsSnapshot(&snapshot);
+
+  PyObject *result = PyDict_New();
+  if (result == 0) {
+    return 0;
+  }
+  if (!SetStatsItem(result, "calls", PyLong_FromUnsignedLongLong(snapshot.calls)) ||
+      !SetStatsItem(result, "documents", PyLong_FromUnsignedLongLong(snapshot.documents)) ||
+      !SetStatsItem(result, "bytes", PyLong_FromUnsignedLongLong(snapshot.bytesIn)) ||
+      !SetStatsItem(result, "textBytesFound", PyLong_FromUnsignedLongLong(snapshot.textBytesFound)) ||
+      !SetStatsItem(result, "reliable", PyLong_FromUnsignedLongLong(snapshot.reliable)) ||
+      !SetStatsItem(result, "reliableRate", PyFloat_FromDouble(snapshot.documents == 0 ? 0.0 : (double) snapshot.reliable / snapshot.documents)) ||
+      !SetStatsItem(result, "unknown", PyLong_FromUnsignedLongLong(snapshot.unknown)) ||
+      !SetStatsItem(result, "invalidUTF8", PyLong_FromUnsignedLongLong(snapshot.invalidUTF8)) ||
+      !SetStatsItem(result, "detectSeconds", PyFloat_FromDouble(snapshot.detectNanos / 1e9)) ||
+      !SetStatsItem(result, "detectTimeHistogram", BuildStatsHistogram(snapshot)) ||
+      !SetStatsItem(result, "languages", BuildStatsLanguages(GETSTATE(self), snapshot))) {
+    Py_DECREF(result);
+    return 0;
+  }
+  return result;
+}
+
+static PyObject *
+reset_stats(PyObject *self) {
+  StatsReset();
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+set_cache(PyObject *self, PyObject *args, PyObject *kwArgs) {
+  PyObject *maxEntriesArg;
+  int maxBytes = 256;
+  static const char *kwList[] = {"maxEntries", "maxBytes", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kwArgs, "O|i", (char **) kwList, &maxEntriesArg, &maxBytes)) {
+    return 0;
+  }
+  PyObject *index = PyNumber_Index(maxEntriesArg);
+  if (index == 0) {
+    return 0;
+  }
+  int overflow;
+  long long maxEntries = PyLong_AsLongLongAndOverflow(index, &overflow);
+  Py_DECREF(index);
+  if (maxEntries == -1 && PyErr_Occurred()) {
+    return 0;
+  }
+  if (overflow != 0 || maxEntries < 0 || maxEntries > INT_MAX) {
+    PyErr_Format(PyExc_ValueError, "maxEntries must be between 0 and %d", INT_MAX);
+    return 0;
+  }
+  if (maxBytes < 0) {
+    PyErr_SetString(PyExc_ValueError, "maxBytes must not be negative");
+    return 0;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  GetResultCache()->Configure((int) maxEntries, maxBytes);
+  Py_END_ALLOW_THREADS
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+cache_stats(PyObject *self) {
+  CacheStats stats;
 
   Py_BEGIN_ALLOW_THREADS
-  CLD2::ExtDetectLanguageSummaryCheckUTF8(bytes, numBytes,
-                                          isPlainText != 0,
-                                          &cldHints,
-                                          flags,
-                                          language3,
-                                          percent3,
-                                          normalized_score3,
-                                          returnVectors != 0 ? &resultChunkVector : 0,
-                                          &textBytesFound,
-                                          &isReliable,
-                                          &validPrefixBytes);
+  GetResultCache()->GetStats(&stats);
   Py_END_ALLOW_THREADS
 
-  if (validPrefixBytes < numBytes) {
-    PyErr_Format(CLDError, "input contains invalid UTF-8 around byte %d (of %d)", validPrefixBytes, numBytes);
-    return 0;
-  }
+  return Py_BuildValue("{sKsKsKsKsisi}",
+                       "hits", (unsigned long long) stats.hits,
+                       "misses", (unsigned long long) stats.misses,
+                       "evictions", (unsigned long long) stats.evictions,
+                       "entries", (unsigned long long) stats.entries,
+                       "maxEntries", stats.maxEntries,
+                       "maxBytes", stats.maxBytes);
+}
 
-  PyObject *details = PyTuple_New(3);
-  for(int idx=0;idx<3;idx++) {
-    CLD2::Language lang = language3[idx];
-    // Steals ref:
-    PyTuple_SET_ITEM(details, idx, Py_BuildValue("(ssif)",
-                                                 CLD2::LanguageName(lang),
-                                                 CLD2::LanguageCode(lang),
-                                                 percent3[idx],
-                                                 normalized_score3[idx]));
-  }
+const char *SET_CACHE_DOC =
+  "set_cache(maxEntries, maxBytes=256): cache results of short inputs.\n\n"
 
-  PyObject *result;
+  "Once enabled, every detect call (detect, detect_batch, detect_file and\n"
+  "Detector) first looks inputs of at most maxBytes bytes up in a\n"
+  "process-wide cache, keyed on a hash of the bytes and of every option\n"
+  "that can change the result, and only runs CLD2 on a miss.  The cache\n"
+  "holds at most about maxEntries results, spread over 64 lock-striped\n"
+  "shards that each evict their least recently used entry, so it scales\n"
+  "across threads detecting with the GIL released.  Calls with a debug*\n"
+  "flag are never cached.\n\n"
 
-  if (returnVectors != 0) {
-    PyObject *resultChunks = PyTuple_New(resultChunkVector.size());
-    for(unsigned int i=0;i<resultChunkVector.size();i++) {
-      CLD2::ResultChunk chunk = resultChunkVector.at(i);
-      CLD2::Language lang = static_cast<CLD2::Language>(chunk.lang1);
-      // Steals ref:
-      PyTuple_SET_ITEM(resultChunks, i, 
-                       Py_BuildValue("(iiss)",
-                                     chunk.offset, chunk.bytes,
-                                     CLD2::LanguageName(lang),
-                                     CLD2::LanguageCode(lang)));
-    }
-    result = Py_BuildValue("(OiOO)",
-                           isReliable ? Py_True : Py_False,
-                           textBytesFound,
-                           details,
-                           resultChunks);
-  } else {
-    result = Py_BuildValue("(OiO)",
-                           isReliable ? Py_True : Py_False,
-                           textBytesFound,
-                           details);
-  }
+  "Calling set_cache again drops every cached result; maxEntries=0\n"
+  "disables the cache (the default).  See cache_stats() for hit and miss\n"
+  "counts.";
 
-  Py_DECREF(details);
-  return result;
-}
+const char *CACHE_STATS_DOC =
+  "cache_stats(): return a dict of the result cache's hits, misses,\n"
+  "evictions and current entries since the process started, plus its\n"
+  "maxEntries and maxBytes settings (0 while disabled).";
 
-const char *DOC =
-  "Detect language(s) from a UTF8 string.\n\n"
+static PyObject *
+load_tables(PyObject *self, PyObject *args) {
+  PyObject *pathArg;
+  if (!PyArg_ParseTuple(args, "O", &pathArg)) {
+    return 0;
+  }
 
-  "Arguments:\n\n"
-  "  utf8Bytes: The text to detect, encoded as UTF-8 bytes (required).  If\n"
-  "             this is not valid UTF-8, then an cld2.error is raised.\n\n"
+#ifdef CLD2_DYNAMIC_MODE
+  PyObject *pathBytes;
+#ifdef IS_PY3K
+  if (!PyUnicode_FSConverter(pathArg, &pathBytes)) {
+    return 0;
+  }
+#else
+  if (!PyString_Check(pathArg)) {
+    PyErr_SetString(PyExc_TypeError, "path must be a str");
+    return 0;
+  }
+  pathBytes = pathArg;
+  Py_INCREF(pathBytes);
+#endif
 
-  "  isPlainText: If False, then the input is HTML and CLD will skip HTML tags,\n"
-  "               expand HTML entities, detect HTML <lang ...> tags, etc.\n\n"
+  bool alreadyLoaded;
+  bool loaded = false;
 
-  "  hintTopLevelDomain: E.g., 'id' boosts Indonesian\n\n"
+  Py_BEGIN_ALLOW_THREADS
+  std::lock_guard<std::mutex> lock(tablesMu);
+  alreadyLoaded = tablesLoaded.load();
+  if (!alreadyLoaded) {
+    CLD2::loadDataFromFile(PyBytes_AS_STRING(pathBytes));
+    loaded = CLD2::isDataLoaded();
+    if (loaded) {
+      tablesLoaded.store(true);
+    }
+  }
+  Py_END_ALLOW_THREADS
 
-  "  hintLanguage: E.g., 'ITALIAN' or 'it' boosts Italian; see cld.LANGUAGES\n"
-  "                for all known language\n\n"
+  if (alreadyLoaded) {
+    PyErr_SetString(GETSTATE(self)->error, "language tables are already loaded");
+  } else if (!loaded) {
+    PyErr_Format(GETSTATE(self)->error, "could not load language tables from %s", PyBytes_AS_STRING(pathBytes));
+  }
+  Py_DECREF(pathBytes);
+  if (alreadyLoaded || !loaded) {
+    return 0;
+  }
+  Py_RETURN_NONE;
+#else
+  PyErr_SetString(GETSTATE(self)->error, "this module has its language tables compiled in; build it with CLD2_DYNAMIC = True in setup.py to load them from a file");
+  return 0;
+#endif
+}
 
-  "  hintLanguageHTTPHeaders: E.g., 'mi,en' boosts Maori and English\n\n"
+const char *LOAD_TABLES_DOC =
+  "load_tables(path): memory-map the language tables from path.\n\n"
 
-  "  hintEncoding: E.g, 'SJS' boosts Japanese; see cld.ENCODINGS for all known\n"
-  "                encodings\n\n"
+  "Only for modules built with CLD2_DYNAMIC = True (see setup.py), which\n"
+  "have no tables compiled in and so import almost instantly; every\n"
+  "other call raises cld2.error until the tables are loaded.  path is a\n"
+  "file written by CLD2's cld2_dynamic_data_tool, for the same tables\n"
+  "(small for cld2, full for cld2full).  The file is mapped read-only,\n"
+  "so all processes loading it share one physical copy; in a prefork\n"
+  "server, load the tables once in the parent before forking.  Tables\n"
+  "can be loaded only once per process.";
 
-  "  returnVectors: If True then the vectors indicating which language was\n"
-  "                 detected in which byte range are returned in addition to\n"
-  "                 details.  The vectors are a sequence of (bytesOffset,\n"
-  "                 bytesLength, languageName, languageCode), in order.\n"
-  "                 bytesOffset is the start of the vector, bytesLength\n"
-  "                 is the length of the vector.  Note that there is some\n"
-  "                 added CPU cost if this is True.\n\n"
+const char *STATS_DOC =
+  "Return a dict of counters accumulated since the module was loaded (or\n"
+  "reset_stats() was last called), across all threads:\n\n"
 
-  "  debugScoreAsQuads: Normally, several languages are detected solely by their\n"
-  "                     Unicode script.  Combined with appropritate lookup tables,\n"
-  "                     this flag forces them instead to be detected via quadgrams.\n"
-  "                     This can be a useful refinement when looking for meaningful\n"
-  "                     text in these languages, instead of just character sets.\n"
-  "                     The default tables do not support this use.\n\n"
+  "  calls: inputs detected or rejected: one per text of detect*(),\n"
+  "         per item, record or row of detect_batch(), detect_file() and\n"
+  "         detect_column(), per document fed to a Detector and per text\n"
+  "         passed to its detect(), detect_id() or detect_code(); so\n"
+  "         documents plus invalidUTF8\n\n"
 
-  "  debugHTML: For each detection call, write an HTML file to stderr, showing the\n"
-  "             text chunks and their detected languages.  See\n"
-  "             docs/InterpretingCLD2UnitTestOutput.pdf to interpret this output.\n\n"
+  "  documents: texts detected to a result (a Detector's document counts\n"
+  "             once, at finish)\n\n"
 
-  "  bestEffort: If True then allow low-quality results for short text,\n"
-  "              rather than forcing the result to UNKNOWN_LANGUAGE.  This\n"
-  "              may be of use for those desiring approximate results on\n"
-  "              short input text, but there is no claim that these result\n"
-  "              are very good.\n\n"
+  "  bytes: input bytes handed to the detector\n\n"
 
-  "  debugCR: In that HTML file, force a new line for each chunk.\n\n"
+  "  textBytesFound: sum of the results' textBytesFound\n\n"
 
-  "  debugVerbose: In that HTML file, show every lookup entry.\n\n"
+  "  reliable, reliableRate: documents whose result isReliable, and that\n"
+  "                          as a fraction of documents\n\n"
 
-  "  debugQuiet: In that HTML file, suppress most of the output detail.\n\n"
+  "  unknown: documents whose top language is Unknown\n\n"
 
-  "  debugEcho: Echo every input buffer to stderr.\n\n\n"
+  "  invalidUTF8: inputs rejected as invalid UTF-8\n\n"
 
-  "Returns:\n\n"
-  "  isReliable, textBytesFound, details when returnVectors is False\n"
-  "  isReliable, textBytesFound, details, vectors when returnVectors is True\n\n"
+  "  detectSeconds: total time spent detecting with the GIL released\n\n"
 
-  "  isReliable (boolean) is True if the detection is high confidence\n\n"
+  "  detectTimeHistogram: per-call detection time, as a tuple of\n"
+  "                       (upperBoundSeconds, count) pairs; bounds double\n"
+  "                       from 1 usec and the last one is infinity\n\n"
 
-  "  textBytesFound (int) is the total number of bytes of text detected\n\n"
+  "  languages: dict of documents by top language code\n\n"
 
-  "  details is a tuple of up to three detected languages, where each is\n"
-  "  tuple is (languageName, languageCode, percent, score).  percent is\n"
-  "  what percentage of the original text was detected as this language\n"
-  "  and score is the confidence score for that language."
-  ;
+  "Counters are updated with relaxed atomics on per-thread shards, so\n"
+  "they cost little per call; a snapshot taken while other threads are\n"
+  "detecting may be slightly skewed between counters.";
 
 static PyMethodDef CLDMethods[] = {
   {"detect",  (PyCFunction) detect, METH_VARARGS | METH_KEYWORDS, DOC},
+  {"detect_id",  (PyCFunction) detect_id, METH_VARARGS | METH_KEYWORDS, ID_DOC},
+  {"detect_code",  (PyCFunction) detect_code, METH_VARARGS | METH_KEYWORDS, CODE_DOC},
+  {"detect_batch",  (PyCFunction) detect_batch, METH_VARARGS | METH_KEYWORDS, BATCH_DOC},
+  {"detect_file",  (PyCFunction) detect_file, METH_VARARGS | METH_KEYWORDS, FILE_DOC},
+  {"detect_column",  (PyCFunction) detect_column, METH_VARARGS | METH_KEYWORDS, COLUMN_DOC},
+#ifdef IS_PY3K
+  {"detect_async",  (PyCFunction) detect_async, METH_VARARGS | METH_KEYWORDS, ASYNC_DOC},
+#endif
+  {"stats",  (PyCFunction) stats, METH_NOARGS, STATS_DOC},
+  {"set_cache",  (PyCFunction) set_cache, METH_VARARGS | METH_KEYWORDS, SET_CACHE_DOC},
+  {"cache_stats",  (PyCFunction) cache_stats, METH_NOARGS, CACHE_STATS_DOC},
+  {"load_tables",  (PyCFunction) load_tables, METH_VARARGS, LOAD_TABLES_DOC},
+  {"reset_stats",  (PyCFunction) reset_stats, METH_NOARGS, "Zero every counter reported by stats()."},
   {0, 0}        /* Sentinel */
 };
 
-#ifdef IS_PY3K
+// Languages the full tables (libcld2_full) can detect:
+static const char *kFullDetectedLanguages[] = {
+  "ABKHAZIAN",
+  "AFAR",
+  "AFRIKAANS",
+  "AKAN",
+  "ALBANIAN",
+  "AMHARIC",
+  "ARABIC",
+  "ARMENIAN",
+  "ASSAMESE",
+  "AYMARA",
+  "AZERBAIJANI",
+  "BASHKIR",
+  "BASQUE",
+  "BELARUSIAN",
+  "BENGALI",
+  "BIHARI",
+  "BISLAMA",
+  "BOSNIAN",
+  "BRETON",
+  "BULGARIAN",
+  "BURMESE",
+  "CATALAN",
+  "CEBUANO",
+  "CHEROKEE",
+  "CORSICAN",
+  "CROATIAN",
+  "CZECH",
+  "Chinese",
+  "ChineseT",
+  "DANISH",
+  "DHIVEHI",
+  "DUTCH",
+  "DZONGKHA",
+  "ENGLISH",
+  "ESPERANTO",
+  "ESTONIAN",
+  "FAROESE",
+  "FIJIAN",
+  "FINNISH",
+  "FRENCH",
+  "FRISIAN",
+  "GALICIAN",
+  "GANDA",
+  "GEORGIAN",
+  "GERMAN",
+  "GREEK",
+  "GREENLANDIC",
+  "GUARANI",
+  "GUJARATI",
+  "HAITIAN_CREOLE",
+  "HAUSA",
+  "HAWAIIAN",
+  "HEBREW",
+  "HINDI",
+  "HMONG",
+  "HUNGARIAN",
+  "ICELANDIC",
+  "IGBO",
+  "INDONESIAN",
+  "INTERLINGUA",
+  "INTERLINGUE",
+  "INUKTITUT",
+  "INUPIAK",
+  "IRISH",
+  "ITALIAN",
+  "JAVANESE",
+  "Japanese",
+  "KANNADA",
+  "KASHMIRI",
+  "KAZAKH",
+  "KHASI",
+  "KHMER",
+  "KINYARWANDA",
+  "KURDISH",
+  "KYRGYZ",
+  "Korean",
+  "LAOTHIAN",
+  "LATIN",
+  "LATVIAN",
+  "LIMBU",
+  "LINGALA",
+  "LITHUANIAN",
+  "LUXEMBOURGISH",
+  "MACEDONIAN",
+  "MALAGASY",
+  "MALAY",
+  "MALAYALAM",
+  "MALTESE",
+  "MANX",
+  "MAORI",
+  "MARATHI",
+  "MAURITIAN_CREOLE",
+  "MONGOLIAN",
+  "NAURU",
+  "NDEBELE",
+  "NEPALI",
+  "NORWEGIAN",
+  "NORWEGIAN_N",
+  "NYANJA",
+  "OCCITAN",
+  "ORIYA",
+  "OROMO",
+  "PASHTO",
+  "PEDI",
+  "PERSIAN",
+  "POLISH",
+  "PORTUGUESE",
+  "PUNJABI",
+  "QUECHUA",
+  "RHAETO_ROMANCE",
+  "ROMANIAN",
+  "RUNDI",
+  "RUSSIAN",
+  "SAMOAN",
+  "SANGO",
+  "SANSKRIT",
+  "SCOTS",
+  "SCOTS_GAELIC",
+  "SERBIAN",
+  "SESELWA",
+  "SESOTHO",
+  "SHONA",
+  "SINDHI",
+  "SINHALESE",
+  "SISWANT",
+  "SLOVAK",
+  "SLOVENIAN",
+  "SOMALI",
+  "SPANISH",
+  "SUNDANESE",
+  "SWAHILI",
+  "SWEDISH",
+  "SYRIAC",
+  "TAGALOG",
+  "TAJIK",
+  "TAMIL",
+  "TATAR",
+  "TELUGU",
+  "THAI",
+  "TIBETAN",
+  "TIGRINYA",
+  "TONGA",
+  "TSONGA",
+  "TSWANA",
+  "TURKISH",
+  "TURKMEN",
+  "UIGHUR",
+  "UKRAINIAN",
+  "URDU",
+  "UZBEK",
+  "VENDA",
+  "VIETNAMESE",
+  "VOLAPUK",
+  "WARAY_PHILIPPINES",
+  "WELSH",
+  "WOLOF",
+  "XHOSA",
+  "X_Buginese",
+  "X_Gothic",
+  "X_KLINGON",
+  "X_PIG_LATIN",
+  "YIDDISH",
+  "YORUBA",
+  "ZHUANG",
+  "ZULU",
+  0
+};
 
-static int cld_traverse(PyObject *m, visitproc visit, void *arg) {
-  Py_VISIT(GETSTATE(m)->error);
-  return 0;
-}
+// Languages the small tables (libcld2) can detect.
+// List originally sent by Dick Sites on 7/17/2013, then I
+// added 6 new languages from the Jan 2014 release, and
+// removed 5 and added 13 langs from the Oct 2014 release:
+static const char *kSmallDetectedLanguages[] = {
+  "AFRIKAANS",
+  "ALBANIAN",
+  "ARABIC",
+  "ARMENIAN",
+  "AZERBAIJANI",
+  "BASQUE",
+  "BELARUSIAN",
+  "BENGALI",
+  "BIHARI",
+  "BOSNIAN",
+  "BULGARIAN",
+  "BURMESE",
+  "CATALAN",
+  "CEBUANO",
+  "CHEROKEE",
+  "CROATIAN",
+  "CZECH",
+  "Chinese",
+  "ChineseT",
+  "DANISH",
+  "DHIVEHI",
+  "DUTCH",
+  "ENGLISH",
+  "ESTONIAN",
+  "FINNISH",
+  "FRENCH",
+  "GALICIAN",
+  "GANDA",
+  "GEORGIAN",
+  "GERMAN",
+  "GREEK",
+  "GUJARATI",
+  "HAITIAN_CREOLE",
+  "HEBREW",
+  "HINDI",
+  "HMONG",
+  "HUNGARIAN",
+  "ICELANDIC",
+  "INDONESIAN",
+  "INUKTITUT",
+  "IRISH",
+  "ITALIAN",
+  "JAVANESE",
+  "Japanese",
+  "KANNADA",
+  "KAZAKH",
+  "KHMER",
+  "KINYARWANDA",
+  "KURDISH",
+  "KYRGYZ",
+  "Korean",
+  "LAOTHIAN",
+  "LATVIAN",
+  "LIMBU",
+  "LITHUANIAN",
+  "MACEDONIAN",
+  "MALAGASY",
+  "MALAY",
+  "MALAYALAM",
+  "MALTESE",
+  "MARATHI",
+  "NEPALI",
+  "NORWEGIAN",
+  "NYANJA",
+  "ORIYA",
+  "PERSIAN",
+  "POLISH",
+  "PORTUGUESE",
+  "PUNJABI",
+  "ROMANIAN",
+  "RUSSIAN",
+  "SCOTS_GAELIC",
+  "SERBIAN",
+  "SESOTHO",
+  "SINHALESE",
+  "SLOVAK",
+  "SLOVENIAN",
+  "SPANISH",
+  "SUNDANESE",
+  "SWAHILI",
+  "SWEDISH",
+  "SYRIAC",
+  "TAGALOG",
+  "TAJIK",
+  "TAMIL",
+  "TELUGU",
+  "THAI",
+  "TURKISH",
+  "UKRAINIAN",
+  "URDU",
+  "UZBEK",
+  "VIETNAMESE",
+  "WELSH",
+  "YIDDISH",
+  0
+};
 
-static int cld_clear(PyObject *m) {
-  Py_CLEAR(GETSTATE(m)->error);
-  return 0;
+static PyObject *
+NewNameTuple(const char **names) {
+  Py_ssize_t count = 0;
+  while (names[count] != 0) {
+    count++;
+  }
+  PyObject *tuple = PyTuple_New(count);
+  if (tuple == 0) {
+    return 0;
+  }
+  for(Py_ssize_t i=0;i<count;i++) {
+    PyObject *name = PyUnicode_FromString(names[i]);
+    if (name == 0) {
+      Py_DECREF(tuple);
+      return 0;
+    }
+    // Steals ref:
+    PyTuple_SET_ITEM(tuple, i, name);
+  }
+  return tuple;
 }
 
-static struct PyModuleDef moduledef = {
-  PyModuleDef_HEAD_INIT,
-  "cld",
-  NULL,
-  sizeof(struct PYCLDState),
-  CLDMethods,
-  NULL,
-  cld_traverse,
-  cld_clear,
-  NULL
-};
-
-#define INITERROR return NULL
+// Fills in the module m; returns 0, or -1 with an exception set:
+static int
+cld_exec(PyObject *m) {
+  struct PYCLDState *st = GETSTATE(m);
 
-//PyObject *
-PyMODINIT_FUNC
 #ifdef CLD2_FULL
-PyInit_cld2full(void)
+  st->error = PyErr_NewException((char *) "cld2full.error", NULL, NULL);
 #else
-PyInit_cld2(void)
+  st->error = PyErr_NewException((char *) "cld2.error", NULL, NULL);
 #endif
 
-#else  // IS_PY3K
+  if (st->error == NULL) {
+    return -1;
+  }
 
-#define INITERROR return
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    CLD2::Language lang = static_cast<CLD2::Language>(i);
+    const char *name = CLD2::LanguageName(lang);
+    const char *code = CLD2::LanguageCode(lang);
+    st->languageNames[i] = PyString_InternFromString(name != 0 ? name : "");
+    st->languageCodes[i] = PyString_InternFromString(code != 0 ? code : "");
+    if (st->languageNames[i] == 0 || st->languageCodes[i] == 0) {
+      return -1;
+    }
+  }
 
-PyMODINIT_FUNC
-#ifdef CLD2_FULL
-initcld2full()
+#ifdef PYCLD_MULTI_PHASE
+  st->detectionResultType = PyStructSequence_NewType(&DetectionResult_desc);
+  st->detectionResultWithVectorsType = PyStructSequence_NewType(&DetectionResultWithVectors_desc);
+  st->languageDetailType = PyStructSequence_NewType(&LanguageDetail_desc);
+  st->chunkVectorsType = PyStructSequence_NewType(&ChunkVectors_desc);
+  st->traceType = PyStructSequence_NewType(&Trace_desc);
+  st->tracePassType = PyStructSequence_NewType(&TracePass_desc);
+  st->traceChunkType = PyStructSequence_NewType(&TraceChunk_desc);
 #else
-initcld2()
+  st->detectionResultType = InitStructType(&DetectionResultType, &DetectionResult_desc);
+  st->detectionResultWithVectorsType = InitStructType(&DetectionResultWithVectorsType, &DetectionResultWithVectors_desc);
+  st->languageDetailType = InitStructType(&LanguageDetailType, &LanguageDetail_desc);
+  st->chunkVectorsType = InitStructType(&ChunkVectorsType, &ChunkVectors_desc);
+  st->traceType = InitStructType(&TraceType, &Trace_desc);
+  st->tracePassType = InitStructType(&TracePassType, &TracePass_desc);
+  st->traceChunkType = InitStructType(&TraceChunkType, &TraceChunk_desc);
 #endif
-#endif
-{
+  if (st->detectionResultType == 0 || st->detectionResultWithVectorsType == 0 ||
+      st->languageDetailType == 0 || st->chunkVectorsType == 0 ||
+      st->traceType == 0 || st->tracePassType == 0 || st->traceChunkType == 0) {
+    return -1;
+  }
+  Py_INCREF(st->detectionResultType);
+  // Steals ref:
+  PyModule_AddObject(m, "DetectionResult", (PyObject *) st->detectionResultType);
+  Py_INCREF(st->detectionResultWithVectorsType);
+  // Steals ref:
+  PyModule_AddObject(m, "DetectionResultWithVectors", (PyObject *) st->detectionResultWithVectorsType);
+  Py_INCREF(st->languageDetailType);
+  // Steals ref:
+  PyModule_AddObject(m, "LanguageDetail", (PyObject *) st->languageDetailType);
+  Py_INCREF(st->chunkVectorsType);
+  // Steals ref:
+  PyModule_AddObject(m, "ChunkVectors", (PyObject *) st->chunkVectorsType);
+  Py_INCREF(st->traceType);
+  // Steals ref:
+  PyModule_AddObject(m, "Trace", (PyObject *) st->traceType);
+  Py_INCREF(st->tracePassType);
+  // Steals ref:
+  PyModule_AddObject(m, "TracePass", (PyObject *) st->tracePassType);
+  Py_INCREF(st->traceChunkType);
+  // Steals ref:
+  PyModule_AddObject(m, "TraceChunk", (PyObject *) st->traceChunkType);
 
-#ifdef IS_PY3K
-  PyObject *m = PyModule_Create(&moduledef);
-#else
-#ifdef CLD2_FULL
-  PyObject* m = Py_InitModule("cld2full", CLDMethods);
-#else
-  PyObject* m = Py_InitModule("cld2", CLDMethods);
-#endif
-#endif
+  PyObject *arrayModule = PyImport_ImportModule("array");
+  if (arrayModule == 0) {
+    return -1;
+  }
+  st->arrayType = PyObject_GetAttrString(arrayModule, "array");
+  Py_DECREF(arrayModule);
+  if (st->arrayType == 0) {
+    return -1;
+  }
 
-  if (m == NULL) {
-    INITERROR;
+  st->unknownDetail = NewLanguageDetail(st, CLD2::UNKNOWN_LANGUAGE, 0, 0.0);
+  if (st->unknownDetail == 0) {
+    return -1;
   }
 
-  struct PYCLDState *st = GETSTATE(m);
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    PyObject *id = PyInt_FromLong(i);
+    if (id == 0) {
+      return -1;
+    }
+    for(int reliable=0;reliable<2;reliable++) {
+      PyObject *pyReliable = reliable ? Py_True : Py_False;
+      st->idResults[i][reliable] = PyTuple_Pack(2, id, pyReliable);
+      st->codeResults[i][reliable] = PyTuple_Pack(2, st->languageCodes[i], pyReliable);
+      if (st->idResults[i][reliable] == 0 || st->codeResults[i][reliable] == 0) {
+        Py_DECREF(id);
+        return -1;
+      }
+    }
+    Py_DECREF(id);
+  }
 
-#ifdef CLD2_FULL
-  st->error = PyErr_NewException((char *) "cld2full.error", NULL, NULL);
+#ifdef PYCLD_MULTI_PHASE
+  st->hintsType = (PyTypeObject *) PyType_FromModuleAndSpec(m, &Hints_spec, 0);
+  st->detectorType = (PyTypeObject *) PyType_FromModuleAndSpec(m, &Detector_spec, 0);
 #else
-  st->error = PyErr_NewException((char *) "cld2.error", NULL, NULL);
+  st->hintsType = PyType_Ready(&HintsType) < 0 ? 0 : &HintsType;
+  st->detectorType = PyType_Ready(&DetectorType) < 0 ? 0 : &DetectorType;
 #endif
-
-  if (st->error == NULL) {
-    Py_DECREF(m);
-    INITERROR;
+  if (st->hintsType == 0 || st->detectorType == 0) {
+    return -1;
   }
+  Py_INCREF(st->hintsType);
+  // Steals ref:
+  PyModule_AddObject(m, "Hints", (PyObject *) st->hintsType);
+  Py_INCREF(st->detectorType);
+  // Steals ref:
+  PyModule_AddObject(m, "Detector", (PyObject *) st->detectorType);
+
+#ifdef IS_PY3K
+  st->asyncCompletions = new AsyncCompletionsMap();
+  st->asyncMu = new std::mutex();
+#endif
 
   // Set module-global ENCODINGS tuple:
   PyObject* pyEncs = PyTuple_New(CLD2::NUM_ENCODINGS-1);
@@ -401,7 +3785,7 @@ initcld2()
     if (static_cast<CLD2::Encoding>(encIDX) != CLD2::UNKNOWN_ENCODING) {
       if (upto == PyTuple_Size(pyEncs)) {
         PyErr_SetString(st->error, "failed to initialize cld.ENCODINGS");
-        INITERROR;
+        return -1;
       }
       PyTuple_SET_ITEM(pyEncs, upto++, PyUnicode_FromString(cld_encoding_info[encIDX].name));
     }
@@ -409,7 +3793,7 @@ initcld2()
 
   if (upto != PyTuple_Size(pyEncs)) {
     PyErr_SetString(st->error, "failed to initialize cld.ENCODINGS");
-    INITERROR;
+    return -1;
   }
 
   // Set module-global LANGUAGES tuple:
@@ -422,12 +3806,12 @@ initcld2()
     if (strcmp(name, "Unknown")) {
       if (upto == PyTuple_Size(pyLangs)) {
         PyErr_SetString(st->error, "failed to initialize cld.LANGUAGES");
-        INITERROR;
+        return -1;
       }
       CLD2::Language lang = CLD2::GetLanguageFromName(name);
       if (lang == CLD2::UNKNOWN_LANGUAGE) {
         PyErr_SetString(st->error, "failed to initialize cld.LANGUAGES");
-        INITERROR;
+        return -1;
       }
       PyTuple_SET_ITEM(pyLangs,
                        upto++,
@@ -439,7 +3823,18 @@ initcld2()
 
   if (upto != PyTuple_Size(pyLangs)) {
     PyErr_SetString(st->error, "failed to initialize cld.LANGUAGES");
-    INITERROR;
+    return -1;
+  }
+
+  // Set module-global LANGUAGES_BY_ID tuple, mapping each language id
+  // (as returned by detect_file) to its (name, code):
+  PyObject* pyLangsByID = PyTuple_New(CLD2::NUM_LANGUAGES);
+  // Steals ref:
+  PyModule_AddObject(m, "LANGUAGES_BY_ID", pyLangsByID);
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    PyTuple_SET_ITEM(pyLangsByID,
+                     i,
+                     PyTuple_Pack(2, st->languageNames[i], st->languageCodes[i]));
   }
 
   // Steals ref:
@@ -449,291 +3844,201 @@ initcld2()
   PyModule_AddObject(m, "VERSION", PyString_FromString(CLD2::DetectLanguageVersion()));
 #endif
 
-  // Set module-global DETECTED_LANGUAGES tuple:
+  // Set module-global DETECTED_LANGUAGES tuple, for the tables this
+  // module is linked against, and DETECTED_LANGUAGES_BY_TABLES, for
+  // both table sets:
+  PyObject *smallLangs = NewNameTuple(kSmallDetectedLanguages);
+  PyObject *fullLangs = NewNameTuple(kFullDetectedLanguages);
+  PyObject *langsByTables = PyDict_New();
+  if (smallLangs == 0 || fullLangs == 0 || langsByTables == 0 ||
+      PyDict_SetItemString(langsByTables, TableSetName(0), smallLangs) != 0 ||
+      PyDict_SetItemString(langsByTables, TableSetName(1), fullLangs) != 0) {
+    Py_XDECREF(smallLangs);
+    Py_XDECREF(fullLangs);
+    Py_XDECREF(langsByTables);
+    return -1;
+  }
+  PyObject *detLangs = LinkedTableSetIndex() == 0 ? smallLangs : fullLangs;
+  Py_INCREF(detLangs);
+  Py_DECREF(smallLangs);
+  Py_DECREF(fullLangs);
 
-  upto = 0;
+  // Steals refs:
+  PyModule_AddObject(m, "DETECTED_LANGUAGES", detLangs);
+  PyModule_AddObject(m, "DETECTED_LANGUAGES_BY_TABLES", langsByTables);
 
-#ifdef CLD2_FULL
-  PyObject* detLangs = PyTuple_New(165);
-
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ABKHAZIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AFAR"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AFRIKAANS"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AKAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ALBANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AMHARIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ARABIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ARMENIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ASSAMESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AYMARA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AZERBAIJANI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BASHKIR"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BASQUE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BELARUSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BENGALI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BIHARI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BISLAMA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BOSNIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BRETON"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BULGARIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BURMESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CATALAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CEBUANO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CHEROKEE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CORSICAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CROATIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CZECH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Chinese"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ChineseT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DANISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DHIVEHI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DUTCH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DZONGKHA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ENGLISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ESPERANTO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ESTONIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FAROESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FIJIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FINNISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FRENCH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FRISIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GALICIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GANDA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GEORGIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GERMAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GREEK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GREENLANDIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GUARANI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GUJARATI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HAITIAN_CREOLE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HAUSA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HAWAIIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HEBREW"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HINDI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HMONG"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HUNGARIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ICELANDIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("IGBO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INDONESIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INTERLINGUA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INTERLINGUE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INUKTITUT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INUPIAK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("IRISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ITALIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("JAVANESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Japanese"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KANNADA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KASHMIRI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KAZAKH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KHASI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KHMER"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KINYARWANDA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KURDISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KYRGYZ"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Korean"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LAOTHIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LATIN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LATVIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LIMBU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LINGALA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LITHUANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LUXEMBOURGISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MACEDONIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAGASY"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAY"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAYALAM"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALTESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MANX"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MAORI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MARATHI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MAURITIAN_CREOLE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MONGOLIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NAURU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NDEBELE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NEPALI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NORWEGIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NORWEGIAN_N"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NYANJA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("OCCITAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ORIYA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("OROMO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PASHTO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PEDI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PERSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("POLISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PORTUGUESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PUNJABI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("QUECHUA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("RHAETO_ROMANCE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ROMANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("RUNDI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("RUSSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SAMOAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SANGO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SANSKRIT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SCOTS"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SCOTS_GAELIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SERBIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SESELWA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SESOTHO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SHONA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SINDHI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SINHALESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SISWANT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SLOVAK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SLOVENIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SOMALI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SPANISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SUNDANESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SWAHILI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SWEDISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SYRIAC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAGALOG"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAJIK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAMIL"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TATAR"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TELUGU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("THAI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TIBETAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TIGRINYA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TONGA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TSONGA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TSWANA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TURKISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TURKMEN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("UIGHUR"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("UKRAINIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("URDU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("UZBEK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("VENDA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("VIETNAMESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("VOLAPUK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("WARAY_PHILIPPINES"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("WELSH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("WOLOF"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("XHOSA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("X_Buginese"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("X_Gothic"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("X_KLINGON"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("X_PIG_LATIN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("YIDDISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("YORUBA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ZHUANG"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ZULU"));
-#else
-  PyObject* detLangs = PyTuple_New(94);
-  
-  // List originally sent by Dick Sites on 7/17/2013, then I
-  // added 6 new languages from the Jan 2014 release, and
-  // removed 5 and added 13 langs from the Oct 2014 release:
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AFRIKAANS"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ALBANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ARABIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ARMENIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("AZERBAIJANI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BASQUE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BELARUSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BENGALI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BIHARI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BOSNIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BULGARIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("BURMESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CATALAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CEBUANO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CHEROKEE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CROATIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("CZECH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Chinese"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ChineseT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DANISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DHIVEHI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("DUTCH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ENGLISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ESTONIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FINNISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("FRENCH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GALICIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GANDA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GEORGIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GERMAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GREEK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("GUJARATI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HAITIAN_CREOLE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HEBREW"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HINDI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HMONG"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("HUNGARIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ICELANDIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INDONESIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("INUKTITUT"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("IRISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ITALIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("JAVANESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Japanese"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KANNADA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KAZAKH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KHMER"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KINYARWANDA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KURDISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("KYRGYZ"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("Korean"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LAOTHIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LATVIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LIMBU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("LITHUANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MACEDONIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAGASY"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAY"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALAYALAM"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MALTESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("MARATHI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NEPALI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NORWEGIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("NYANJA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ORIYA"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PERSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("POLISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PORTUGUESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("PUNJABI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("ROMANIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("RUSSIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SCOTS_GAELIC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SERBIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SESOTHO"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SINHALESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SLOVAK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SLOVENIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SPANISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SUNDANESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SWAHILI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SWEDISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("SYRIAC"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAGALOG"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAJIK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TAMIL"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TELUGU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("THAI"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("TURKISH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("UKRAINIAN"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("URDU"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("UZBEK"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("VIETNAMESE"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("WELSH"));
-  PyTuple_SET_ITEM(detLangs, upto++, PyUnicode_FromString("YIDDISH"));
+  // Steals ref:
+#ifdef IS_PY3K
+  PyModule_AddObject(m, "TABLES", PyUnicode_FromString(TableSetName(LinkedTableSetIndex())));
+#else
+  PyModule_AddObject(m, "TABLES", PyString_FromString(TableSetName(LinkedTableSetIndex())));
 #endif
 
+  Py_INCREF(st->error);
   // Steals ref:
-  PyModule_AddObject(m, "DETECTED_LANGUAGES", detLangs);
+  PyModule_AddObject(m, "error", st->error);
+  return 0;
+}
+
+#ifdef IS_PY3K
 
-  if (upto != PyTuple_Size(detLangs)) {
-    PyErr_SetString(st->error, "failed to initialize cld.DETECTED_LANGUAGES");
-    INITERROR;
+static int cld_traverse(PyObject *m, visitproc visit, void *arg) {
+  struct PYCLDState *st = GETSTATE(m);
+  Py_VISIT(st->error);
+#ifdef PYCLD_MULTI_PHASE
+  Py_VISIT(st->hintsType);
+  Py_VISIT(st->detectorType);
+  Py_VISIT(st->detectionResultType);
+  Py_VISIT(st->detectionResultWithVectorsType);
+  Py_VISIT(st->languageDetailType);
+  Py_VISIT(st->chunkVectorsType);
+  Py_VISIT(st->traceType);
+  Py_VISIT(st->tracePassType);
+  Py_VISIT(st->traceChunkType);
+#endif
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    Py_VISIT(st->languageNames[i]);
+    Py_VISIT(st->languageCodes[i]);
+  }
+  Py_VISIT(st->unknownDetail);
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    for(int reliable=0;reliable<2;reliable++) {
+      Py_VISIT(st->idResults[i][reliable]);
+      Py_VISIT(st->codeResults[i][reliable]);
+    }
   }
+  Py_VISIT(st->arrayType);
+  Py_VISIT(st->getRunningLoop.load());
+  return 0;
+}
 
-  // Steals ref:
-  PyModule_AddObject(m, "error", st->error);
-#ifdef IS_PY3K
+static int cld_clear(PyObject *m) {
+  struct PYCLDState *st = GETSTATE(m);
+  Py_CLEAR(st->error);
+#ifdef PYCLD_MULTI_PHASE
+  Py_CLEAR(st->hintsType);
+  Py_CLEAR(st->detectorType);
+  Py_CLEAR(st->detectionResultType);
+  Py_CLEAR(st->detectionResultWithVectorsType);
+  Py_CLEAR(st->languageDetailType);
+  Py_CLEAR(st->chunkVectorsType);
+  Py_CLEAR(st->traceType);
+  Py_CLEAR(st->tracePassType);
+  Py_CLEAR(st->traceChunkType);
+#endif
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    Py_CLEAR(st->languageNames[i]);
+    Py_CLEAR(st->languageCodes[i]);
+  }
+  Py_CLEAR(st->unknownDetail);
+  for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+    for(int reliable=0;reliable<2;reliable++) {
+      Py_CLEAR(st->idResults[i][reliable]);
+      Py_CLEAR(st->codeResults[i][reliable]);
+    }
+  }
+  Py_CLEAR(st->arrayType);
+  Py_XDECREF(st->getRunningLoop.exchange(0));
+  return 0;
+}
+
+static void cld_free(void *m) {
+  cld_clear((PyObject *) m);
+  struct PYCLDState *st = GETSTATE((PyObject *) m);
+  // Empty by now, since each loop's AsyncCompletions holds the module:
+  delete st->asyncCompletions;
+  st->asyncCompletions = 0;
+  delete st->asyncMu;
+  st->asyncMu = 0;
+}
+
+#ifdef PYCLD_MULTI_PHASE
+
+static PyModuleDef_Slot cld_slots[] = {
+  {Py_mod_exec, (void *) cld_exec},
+#ifdef Py_mod_multiple_interpreters
+  // Each interpreter has its own module state and types, and what is
+  // shared (CLD2's tables, the worker pool, the result cache and the
+  // stats) is native and thread-safe, so subinterpreters with their
+  // own GIL can import it:
+  {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+  // Nor does anything rely on the GIL, so a free-threaded build keeps
+  // it disabled on import:
+  {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+  {0, NULL}
+};
+
+#endif  // PYCLD_MULTI_PHASE
+
+static struct PyModuleDef moduledef = {
+  PyModuleDef_HEAD_INIT,
+  "cld",
+  NULL,
+  sizeof(struct PYCLDState),
+  CLDMethods,
+#ifdef PYCLD_MULTI_PHASE
+  cld_slots,
+#else
+  NULL,
+#endif
+  cld_traverse,
+  cld_clear,
+  cld_free
+};
+
+#ifdef PYCLD_MULTI_PHASE
+static struct PYCLDState *GetTypeState(PyTypeObject *type) {
+  return GETSTATE(PyType_GetModuleByDef(type, &moduledef));
+}
+#else
+static struct PYCLDState *GetTypeState(PyTypeObject *type) {
+  return GETSTATE(PyState_FindModule(&moduledef));
+}
+#endif
+
+//PyObject *
+PyMODINIT_FUNC
+#ifdef CLD2_FULL
+PyInit_cld2full(void)
+#else
+PyInit_cld2(void)
+#endif
+{
+#ifdef PYCLD_MULTI_PHASE
+  return PyModuleDef_Init(&moduledef);
+#else
+  PyObject *m = PyModule_Create(&moduledef);
+  if (m != NULL && cld_exec(m) < 0) {
+    Py_CLEAR(m);
+  }
   return m;
 #endif
 }
+
+#else  // IS_PY3K
+
+static struct PYCLDState *GetTypeState(PyTypeObject *type) {
+  return &_state;
+}
+
+PyMODINIT_FUNC
+#ifdef CLD2_FULL
+initcld2full()
+#else
+initcld2()
+#endif
+{
+#ifdef CLD2_FULL
+  PyObject* m = Py_InitModule("cld2full", CLDMethods);
+#else
+  PyObject* m = Py_InitModule("cld2", CLDMethods);
+#endif
+  if (m != NULL) {
+    cld_exec(m);
+  }
+}
+
+#endif  // IS_PY3K
@@ -0,0 +1,131 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "records.h"
+
+MappedFile::MappedFile() : bytes(0), numBytes(0) {
+}
+
+MappedFile::~MappedFile() {
+  if (numBytes > 0) {
+    munmap((void *) bytes, numBytes);
+  }
+}
+
+bool MappedFile::Open(const char *path, std::string *error) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    *error = std::string("cannot open ") + path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    *error = std::string("cannot stat ") + path + ": " + strerror(errno);
+    close(fd);
+    return false;
+  }
+  if (st.st_size > 0) {
+    void *addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      *error = std::string("cannot mmap ") + path + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+    bytes = (const char *) addr;
+    numBytes = st.st_size;
+  }
+  // The mapping keeps the file alive:
+  close(fd);
+  return true;
+}
+
+static bool
+AddRecord(const char *bytes, size_t numBytes, std::vector<Record> *records, std::string *error) {
+  if (numBytes > INT_MAX) {
+    *error = "record is too large (more than 2 GB)";
+    return false;
+  }
+  Record record;
+  record.bytes = bytes;
+  record.numBytes = (int) numBytes;
+  records->push_back(record);
+  return true;
+}
+
+bool SplitDelimited(const char *bytes, size_t numBytes, const std::string &delimiter,
+                    std::vector<Record> *records, std::string *error) {
+  if (delimiter.empty()) {
+    *error = "delimiter must not be empty";
+    return false;
+  }
+  const char *end = bytes + numBytes;
+  const char *start = bytes;
+  const char *p = bytes;
+  while (p < end) {
+    const char *hit = (const char *) memchr(p, delimiter[0], end - p);
+    if (hit == 0) {
+      break;
+    }
+    if ((size_t) (end - hit) >= delimiter.size() &&
+        memcmp(hit, delimiter.data(), delimiter.size()) == 0) {
+      if (!AddRecord(start, hit - start, records, error)) {
+        return false;
+      }
+      start = p = hit + delimiter.size();
+    } else {
+      p = hit + 1;
+    }
+  }
+  if (start < end) {
+    return AddRecord(start, end - start, records, error);
+  }
+  return true;
+}
+
+bool SplitLengthPrefixed(const char *bytes, size_t numBytes, int prefixBytes,
+                         std::vector<Record> *records, std::string *error) {
+  if (prefixBytes != 1 && prefixBytes != 2 && prefixBytes != 4 && prefixBytes != 8) {
+    *error = "length prefix must be 1, 2, 4 or 8 bytes";
+    return false;
+  }
+  const unsigned char *p = (const unsigned char *) bytes;
+  size_t upto = 0;
+  while (upto < numBytes) {
+    if (numBytes - upto < (size_t) prefixBytes) {
+      *error = "file ends inside a length prefix";
+      return false;
+    }
+    unsigned long long length = 0;
+    for(int i=prefixBytes-1;i>=0;i--) {
+      length = (length << 8) | p[upto + i];
+    }
+    upto += prefixBytes;
+    if (length > numBytes - upto) {
+      *error = "file ends inside a record";
+      return false;
+    }
+    if (!AddRecord(bytes + upto, (size_t) length, records, error)) {
+      return false;
+    }
+    upto += (size_t) length;
+  }
+  return true;
+}
@@ -0,0 +1,63 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Reading a corpus file as a sequence of records.
+
+#ifndef PYCLD_RECORDS_H_
+#define PYCLD_RECORDS_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct Record {
+  const char *bytes;
+  int numBytes;
+};
+
+// A whole file mapped read-only into memory; pages are shared with
+// every other process mapping the same file.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Returns false and sets *error if the file cannot be mapped.
+  bool Open(const char *path, std::string *error);
+
+  const char *data() const {
+    return bytes;
+  }
+
+  size_t size() const {
+    return numBytes;
+  }
+
+ private:
+  const char *bytes;
+  size_t numBytes;
+};
+
+// Appends one record per delimiter-terminated span of bytes; a final
+// span without a delimiter is a record too.
+bool SplitDelimited(const char *bytes, size_t numBytes, const std::string &delimiter,
+                    std::vector<Record> *records, std::string *error);
+
+// Appends one record per length-prefixed span: each record is an
+// unsigned little-endian length of prefixBytes (1, 2, 4 or 8) bytes,
+// followed by that many bytes of text.
+bool SplitLengthPrefixed(const char *bytes, size_t numBytes, int prefixBytes,
+                         std::vector<Record> *records, std::string *error);
+
+#endif  // PYCLD_RECORDS_H_
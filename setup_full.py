@@ -29,6 +29,13 @@ if os.path.exists('build'):
 # sources:
 CLD2_PATH = '../cld2'
 
+# NOTE: set this to True to link against libcld2_dynamic.so instead,
+# which has no tables compiled in: call cld2full.load_tables(path) on
+# a file of the full tables written by CLD2's cld2_dynamic_data_tool
+# (see compile_dynamic.sh) before detecting.  The file is memory-mapped
+# read-only, so every process loading it shares one copy:
+CLD2_DYNAMIC = False
+
 # Test suite
 class cldtest(distutils.core.Command):
     # user_options, initialize_options and finalize_options must be overriden.
@@ -42,12 +49,72 @@ class cldtest(distutils.core.Command):
         errno = subprocess.call([sys.executable, 'tests/cld_test.py'])
         raise SystemExit(errno)
 
+# Native benchmark (bench.cc): builds build/bench/cld2fullbench against
+# libcld2_full and runs it over CLD2's shuffle corpus, e.g.:
+#
+#   python setup_full.py bench --args="--threads 8 --seconds 2"
+class bench(distutils.core.Command):
+    description = 'build and run the native C++ benchmark'
+    user_options = [('args=', None, 'extra arguments for the benchmark')]
+    def initialize_options(self):
+        self.args = ''
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        objects = compiler.compile(['bench.cc', 'cache.cc', 'detect.cc', 'records.cc', 'stats.cc', 'trace.cc', 'transcode.cc', 'utf8.cc', 'workers.cc'],
+                                   output_dir = 'build/bench',
+                                   include_dirs = ['%s/public' % CLD2_PATH, '%s/internal' % CLD2_PATH],
+                                   extra_preargs = ['-DCLD2_FULL', '-std=c++11', '-pthread'])
+        compiler.link_executable(objects, 'cld2fullbench',
+                                 output_dir = 'build/bench',
+                                 libraries = ['cld2_full'],
+                                 extra_preargs = ['-pthread'],
+                                 target_lang = 'c++')
+        errno = subprocess.call(['build/bench/cld2fullbench',
+                                 '--corpus', '%s/internal/test_shuffle_1000_48_666.utf8' % CLD2_PATH] +
+                                self.args.split())
+        raise SystemExit(errno)
+
+# Native command-line detector (cli.cc): builds build/cli/cld2fulldetect
+# against libcld2_full, to classify lines in pipelines without Python, e.g.:
+#
+#   python setup_full.py cli
+#   build/cli/cld2fulldetect --format jsonl --threads 8 < lines.txt > langs.jsonl
+class cli(distutils.core.Command):
+    description = 'build the native command-line detector'
+    user_options = []
+    def initialize_options(self):
+        pass
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        objects = compiler.compile(['cli.cc', 'cache.cc', 'detect.cc', 'encodings.cc', 'stats.cc', 'trace.cc', 'transcode.cc', 'utf8.cc', 'workers.cc'],
+                                   output_dir = 'build/cli',
+                                   include_dirs = ['%s/public' % CLD2_PATH, '%s/internal' % CLD2_PATH],
+                                   extra_preargs = ['-DCLD2_FULL', '-std=c++11', '-pthread'])
+        compiler.link_executable(objects, 'cld2fulldetect',
+                                 output_dir = 'build/cli',
+                                 libraries = ['cld2_full'],
+                                 extra_preargs = ['-pthread'],
+                                 target_lang = 'c++')
+
 module = Extension('cld2full',
                    language='c++',
-                   extra_compile_args = ['-DCLD2_FULL'],
+                   extra_compile_args = ['-DCLD2_FULL', '-std=c++11', '-pthread'] + (['-DCLD2_DYNAMIC_MODE'] if CLD2_DYNAMIC else []),
+                   extra_link_args = ['-pthread', '-ldl'],
                    include_dirs = ['%s/public' % CLD2_PATH, '%s/internal' % CLD2_PATH],
-                   libraries = ['cld2_full'],
-                   sources=['pycldmodule.cc', 'encodings.cc'],
+                   libraries = ['cld2_dynamic' if CLD2_DYNAMIC else 'cld2_full'],
+                   sources=['pycldmodule.cc', 'cache.cc', 'detect.cc', 'encodings.cc', 'records.cc', 'stats.cc', 'tables.cc', 'trace.cc', 'transcode.cc', 'utf8.cc', 'workers.cc'],
                    libdirs = ['./build'],
                    )
 
@@ -57,6 +124,7 @@ setup(name='chromium_compact_language_detector',
       author_email='mail@mikemccandless.com',
       description='Python bindings around Google Chromium\'s embedded compact language detection library (CLD2)',
       ext_modules = [module],
+      cmdclass = {'bench': bench, 'cli': cli},
       license = 'Apache2',
       url = 'http://code.google.com/p/chromium-compact-language-detector/',
       classifiers = [
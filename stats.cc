@@ -0,0 +1,148 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <atomic>
+#include <chrono>
+#include "stats.h"
+
+// Threads are spread round-robin over this many shards:
+static const int kStatsShards = 16;
+
+// Each shard sits on its own cache lines so threads updating different
+// shards never share one:
+struct alignas(64) StatsShard {
+  std::atomic<uint64_t> calls;
+  std::atomic<uint64_t> documents;
+  std::atomic<uint64_t> bytesIn;
+  std::atomic<uint64_t> textBytesFound;
+  std::atomic<uint64_t> reliable;
+  std::atomic<uint64_t> unknown;
+  std::atomic<uint64_t> invalidUTF8;
+  std::atomic<uint64_t> detectNanos;
+  std::atomic<uint64_t> timeHistogram[kStatsTimeBuckets];
+  std::atomic<uint64_t> languages[CLD2::NUM_LANGUAGES];
+};
+
+// Zero-initialized, being static:
+static StatsShard shards[kStatsShards];
+
+static std::atomic<int> nextShard(0);
+
+static StatsShard &
+MyShard() {
+  static thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % kStatsShards;
+  return shards[shard];
+}
+
+static inline void
+Add(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t StatsNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StatsAddCall(uint64_t nanos) {
+  StatsShard &shard = MyShard();
+  Add(shard.calls, 1);
+  Add(shard.detectNanos, nanos);
+  int bucket = 0;
+  for(uint64_t micros=nanos/1000;micros>0&&bucket<kStatsTimeBuckets-1;micros>>=1) {
+    bucket++;
+  }
+  Add(shard.timeHistogram[bucket], 1);
+}
+
+void StatsAddBytes(uint64_t numBytes) {
+  Add(MyShard().bytesIn, numBytes);
+}
+
+void StatsAddResult(const DetectResult &result) {
+  StatsShard &shard = MyShard();
+  Add(shard.documents, 1);
+  Add(shard.textBytesFound, result.textBytesFound);
+  if (result.isReliable) {
+    Add(shard.reliable, 1);
+  }
+  CLD2::Language lang = result.language3[0];
+  if (lang == CLD2::UNKNOWN_LANGUAGE) {
+    Add(shard.unknown, 1);
+  }
+  if (lang >= 0 && lang < CLD2::NUM_LANGUAGES) {
+    Add(shard.languages[lang], 1);
+  }
+}
+
+void StatsAddInvalid() {
+  Add(MyShard().invalidUTF8, 1);
+}
+
+static inline uint64_t
+Get(const std::atomic<uint64_t> &counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+void StatsSnapshot(Stats *stats) {
+  stats->calls = 0;
+  stats->documents = 0;
+  stats->bytesIn = 0;
+  stats->textBytesFound = 0;
+  stats->reliable = 0;
+  stats->unknown = 0;
+  stats->invalidUTF8 = 0;
+  stats->detectNanos = 0;
+  for(int i=0;i<kStatsTimeBuckets;i++) {
+    stats->timeHistogram[i] = 0;
+  }
+  stats->languages.assign(CLD2::NUM_LANGUAGES, 0);
+
+  for(int s=0;s<kStatsShards;s++) {
+    const StatsShard &shard = shards[s];
+    stats->calls += Get(shard.calls);
+    stats->documents += Get(shard.documents);
+    stats->bytesIn += Get(shard.bytesIn);
+    stats->textBytesFound += Get(shard.textBytesFound);
+    stats->reliable += Get(shard.reliable);
+    stats->unknown += Get(shard.unknown);
+    stats->invalidUTF8 += Get(shard.invalidUTF8);
+    stats->detectNanos += Get(shard.detectNanos);
+    for(int i=0;i<kStatsTimeBuckets;i++) {
+      stats->timeHistogram[i] += Get(shard.timeHistogram[i]);
+    }
+    for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+      stats->languages[i] += Get(shard.languages[i]);
+    }
+  }
+}
+
+void StatsReset() {
+  for(int s=0;s<kStatsShards;s++) {
+    StatsShard &shard = shards[s];
+    shard.calls.store(0, std::memory_order_relaxed);
+    shard.documents.store(0, std::memory_order_relaxed);
+    shard.bytesIn.store(0, std::memory_order_relaxed);
+    shard.textBytesFound.store(0, std::memory_order_relaxed);
+    shard.reliable.store(0, std::memory_order_relaxed);
+    shard.unknown.store(0, std::memory_order_relaxed);
+    shard.invalidUTF8.store(0, std::memory_order_relaxed);
+    shard.detectNanos.store(0, std::memory_order_relaxed);
+    for(int i=0;i<kStatsTimeBuckets;i++) {
+      shard.timeHistogram[i].store(0, std::memory_order_relaxed);
+    }
+    for(int i=0;i<CLD2::NUM_LANGUAGES;i++) {
+      shard.languages[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
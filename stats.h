@@ -0,0 +1,68 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Process-wide runtime counters behind cld2.stats().  Every update is a
+// relaxed atomic add on a per-thread shard, so worker threads can
+// record without the GIL and without contending with each other.
+
+#ifndef PYCLD_STATS_H_
+#define PYCLD_STATS_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "detect.h"
+
+// Detection time per call is histogrammed into power-of-two buckets of
+// microseconds: bucket i counts calls that took less than 2^i usec, and
+// the last bucket counts everything slower.
+static const int kStatsTimeBuckets = 24;
+
+struct Stats {
+  uint64_t calls;
+  uint64_t documents;
+  uint64_t bytesIn;
+  uint64_t textBytesFound;
+  uint64_t reliable;
+  uint64_t unknown;
+  uint64_t invalidUTF8;
+  uint64_t detectNanos;
+  uint64_t timeHistogram[kStatsTimeBuckets];
+  // Documents by top language, indexed by CLD2::Language:
+  std::vector<uint64_t> languages;
+};
+
+// Monotonic clock for timing calls, in nanoseconds:
+uint64_t StatsNow();
+
+// One input (a text, record, row or fed document) detected or rejected,
+// which took nanos with the GIL released:
+void StatsAddCall(uint64_t nanos);
+
+// Input bytes handed to the detector:
+void StatsAddBytes(uint64_t numBytes);
+
+// One document detected to completion:
+void StatsAddResult(const DetectResult &result);
+
+// One input rejected as invalid UTF-8:
+void StatsAddInvalid();
+
+// Sums all shards into *stats.  Not atomic across counters, so a
+// snapshot taken while other threads detect may be slightly skewed.
+void StatsSnapshot(Stats *stats);
+
+void StatsReset();
+
+#endif  // PYCLD_STATS_H_
@@ -0,0 +1,90 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <dlfcn.h>
+#include <string.h>
+#include <mutex>
+#include "tables.h"
+
+static const struct {
+  const char *name;
+  const char *library;
+} kTableSets[kNumTableSets] = {
+  {"small", "libcld2.so"},
+  {"full", "libcld2_full.so"},
+};
+
+static std::mutex tablesMu;
+static DetectFunction loadedSets[kNumTableSets];
+
+const char *TableSetName(int index) {
+  return kTableSets[index].name;
+}
+
+int TableSetIndex(const char *name) {
+  for(int i=0;i<kNumTableSets;i++) {
+    if (strcmp(name, kTableSets[i].name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int LinkedTableSetIndex() {
+#ifdef CLD2_FULL
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+bool LoadTableSet(int index, DetectFunction *detect, std::string *error) {
+  if (index == LinkedTableSetIndex()) {
+    *detect = 0;
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(tablesMu);
+  if (loadedSets[index] != 0) {
+    *detect = loadedSets[index];
+    return true;
+  }
+
+  // Look the function up by the (mangled) name it has in the library
+  // we are linked against, so no C++ name is spelled out here:
+  Dl_info info;
+  if (dladdr((void *) &CLD2::ExtDetectLanguageSummaryCheckUTF8, &info) == 0 || info.dli_sname == 0) {
+    *error = "cannot find the symbol name of ExtDetectLanguageSummaryCheckUTF8";
+    return false;
+  }
+
+  int flags = RTLD_NOW | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+  flags |= RTLD_DEEPBIND;
+#endif
+  void *handle = dlopen(kTableSets[index].library, flags);
+  if (handle == 0) {
+    *error = std::string("cannot load the ") + kTableSets[index].name + " tables: " + dlerror();
+    return false;
+  }
+  void *symbol = dlsym(handle, info.dli_sname);
+  if (symbol == 0) {
+    *error = std::string("cannot find ") + info.dli_sname + " in " + kTableSets[index].library;
+    dlclose(handle);
+    return false;
+  }
+  loadedSets[index] = (DetectFunction) symbol;
+  *detect = loadedSets[index];
+  return true;
+}
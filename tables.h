@@ -0,0 +1,44 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// CLD2's two table sets, "small" (libcld2) and "full" (libcld2_full).
+// The module is linked against one of them; the other is dlopen()ed the
+// first time a caller asks for it, privately (RTLD_LOCAL, and
+// RTLD_DEEPBIND where available), since both libraries define the same
+// symbols.
+
+#ifndef PYCLD_TABLES_H_
+#define PYCLD_TABLES_H_
+
+#include <string>
+
+#include "detect.h"
+
+static const int kNumTableSets = 2;
+
+// Name of table set i, e.g. "small":
+const char *TableSetName(int index);
+
+// Index of the named table set, or -1 if there is none:
+int TableSetIndex(const char *name);
+
+// Index of the table set this module was linked against:
+int LinkedTableSetIndex();
+
+// Sets *detect to the detect function of table set index, loading its
+// library on first use (0 for the linked set).  Returns false and sets
+// *error if the library cannot be loaded.  Libraries are never unloaded.
+bool LoadTableSet(int index, DetectFunction *detect, std::string *error);
+
+#endif  // PYCLD_TABLES_H_
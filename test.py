@@ -14,9 +14,12 @@
 # limitations under the License.
 #
 
+import copy
 import os
+import pickle
 import sys
 import stat
+import tempfile
 import unittest
 import traceback
 
@@ -385,6 +388,21 @@ class TestCLD(unittest.TestCase):
       except:
         print('GOT WRONG EXC: %s vs %s: %s' % (str(sys.exc_info()), cld2.error, cld2.error == sys.exc_info()[0]))
 
+  def test_invalid_utf8_modes(self):
+    for detector in cld2, cld2full:
+      for mode in 'replace', 'skip':
+        isReliable, textBytesFound, details = detector.detect(TEST_EN_LATN_BAD_UTF8, invalidUTF8=mode)
+        self.assertEqual('ENGLISH', details[0][0])
+      self.assertRaises(detector.error, detector.detect, TEST_EN_LATN_BAD_UTF8, invalidUTF8='error')
+      self.assertRaises(ValueError, detector.detect, 'text', invalidUTF8='ignore')
+      if sys.version_info >= (3,):
+        # Same as repairing it in Python first:
+        bad = b'Le renard brun \xff saute par-dessus \xe2\x82 le chien paresseux. ' * 5
+        self.assertEqual(detector.detect(bad.decode('utf-8', 'replace'), returnVectors=True),
+                         detector.detect(bad, invalidUTF8='replace', returnVectors=True))
+        self.assertEqual(detector.detect(bad.decode('utf-8', 'ignore'), returnVectors=True),
+                         detector.detect(bad, invalidUTF8='skip', returnVectors=True))
+
   def test_best_effort(self):
     for detector in cld2, cld2full:
       isReliable, textBytesFound, details = detector.detect('interaktive infografik \xc3\xbcber videospielkonsolen')
@@ -398,6 +416,552 @@ class TestCLD(unittest.TestCase):
       self.assertTrue(isReliable)
       self.assertNotEqual(details[0][0], 'Unknown')
 
+  def test_batch(self):
+    for detector in cld2, cld2full:
+      texts = [text for lang, text in testData]
+      for threads in 1, 4, 0:
+        results = detector.detect_batch(texts, returnVectors=True, threads=threads)
+        self.assertEqual(len(texts), len(results))
+        for text, result in zip(texts, results):
+          self.assertEqual(detector.detect(text, returnVectors=True), result)
+      self.assertEqual([], detector.detect_batch([]))
+      self.assertRaises(detector.error, detector.detect_batch, [texts[0], TEST_EN_LATN_BAD_UTF8])
+      self.assertRaises(TypeError, detector.detect_batch, 42)
+      self.assertRaises(ValueError, detector.detect_batch, texts, threads=-1)
+      self.assertRaises(ValueError, detector.detect, texts[0], threads=-1)
+      # The batch is copied first, so an input that empties the list
+      # while it is read cannot pull items out from under it:
+      if sys.version_info >= (3, 12):
+        batch = []
+        class Shrinking(object):
+          def __buffer__(self, flags):
+            del batch[:]
+            return memoryview(b'hello world')
+        batch.extend([Shrinking()] + texts)
+        self.assertEqual(len(texts) + 1, len(detector.detect_batch(batch)))
+
+  def test_buffer_inputs(self):
+    for detector in cld2, cld2full:
+      if isinstance(fr_en_Latn, bytes):
+        # Python 2
+        utf8 = fr_en_Latn
+      else:
+        utf8 = fr_en_Latn.encode('utf-8')
+      expected = detector.detect(utf8, returnVectors=True)
+      self.assertEqual(expected, detector.detect(fr_en_Latn, returnVectors=True))
+      self.assertEqual(expected, detector.detect(bytearray(utf8), returnVectors=True))
+      padded = memoryview(b'xxxx' + utf8 + b'yyyy')
+      self.assertEqual(expected, detector.detect(padded[4:-4], returnVectors=True))
+      self.assertRaises(TypeError, detector.detect, 17)
+
+  def test_detector(self):
+    for detector in cld2, cld2full:
+      for lang, text in testData:
+        if not isinstance(text, bytes):
+          text = text.encode('utf-8')
+        # Small chunks split UTF-8 sequences; one piece matches detect():
+        d = detector.Detector(returnVectors=True)
+        for i in range(0, len(text), 7):
+          d.feed(text[i:i+7])
+        self.assertEqual(detector.detect(text, returnVectors=True), d.finish())
+
+        # Many pieces: the merged result must still be well formed:
+        d = detector.Detector(returnVectors=True, pieceBytes=64)
+        for i in range(0, len(text), 7):
+          d.feed(text[i:i+7])
+        isReliable, textBytesFound, details, vectors = d.finish()
+        self.assertEqual(3, len(details))
+        self.assertTrue(sum(x[2] for x in details) <= 100)
+        if len(vectors) > 0:
+          self.assertTrue(vectors[-1][0] + vectors[-1][1] <= len(text))
+
+      d = detector.Detector()
+      d.feed(TEST_EN_LATN_BAD_UTF8)
+      self.assertRaises(detector.error, d.finish)
+
+      # Failing for lack of __init__ leaves the Detector usable once
+      # it is initialized:
+      d = detector.Detector.__new__(detector.Detector)
+      self.assertRaises(RuntimeError, d.feed, 'hello')
+      self.assertRaises(RuntimeError, d.finish)
+      d.__init__()
+      d.feed(fr_en_Latn)
+      self.assertEqual(detector.detect(fr_en_Latn), d.finish())
+
+  def test_detector_call(self):
+    for detector in cld2, cld2full:
+      d = detector.Detector(isPlainText=True, bestEffort=True, hintLanguage='fr')
+      for lang, text in testData:
+        self.assertEqual(detector.detect(text, isPlainText=True, bestEffort=True, hintLanguage='fr'), d(text))
+
+      # Calling leaves the document being fed alone:
+      d = detector.Detector(returnVectors=True)
+      d.feed(fr_en_Latn[:100])
+      self.assertEqual(detector.detect('the quick brown fox', returnVectors=True), d('the quick brown fox'))
+      d.feed(fr_en_Latn[100:])
+      self.assertEqual(detector.detect(fr_en_Latn, returnVectors=True), d.finish())
+
+      self.assertRaises(detector.error, d, TEST_EN_LATN_BAD_UTF8)
+      self.assertRaises(TypeError, d)
+      self.assertRaises(TypeError, d, 'a', 'b')
+      self.assertRaises(TypeError, d, 'a', returnVectors=False)
+
+  def test_detect_id(self):
+    for detector in cld2, cld2full:
+      d = detector.Detector(isPlainText=True)
+      for lang, text in testData:
+        isReliable, textBytesFound, details = detector.detect(text, isPlainText=True)
+        langID, reliable = detector.detect_id(text, isPlainText=True)
+        self.assertEqual(details[0][:2], detector.LANGUAGES_BY_ID[langID])
+        self.assertEqual(isReliable, reliable)
+        self.assertEqual((details[0][1], isReliable), detector.detect_code(text, isPlainText=True))
+        self.assertEqual((langID, reliable), d.detect_id(text))
+        self.assertEqual((details[0][1], reliable), d.detect_code(text))
+
+      # Results are shared, not built per call:
+      self.assertTrue(detector.detect_id('') is detector.detect_id(b''))
+      self.assertEqual(('Unknown', 'un'), detector.LANGUAGES_BY_ID[detector.detect_id('')[0]])
+      self.assertRaises(detector.error, detector.detect_id, TEST_EN_LATN_BAD_UTF8)
+      self.assertRaises(detector.error, d.detect_code, TEST_EN_LATN_BAD_UTF8)
+      self.assertEqual(detector.detect_id(fr_en_Latn, languages=['fr'])[0],
+                       detector.detect_id(fr_en_Latn, hints=detector.Hints(languages=['fr']))[0])
+
+  def test_detect_file(self):
+    texts = []
+    for lang, text in testData:
+      if not isinstance(text, bytes):
+        text = text.encode('utf-8')
+      texts.append(text.replace(b'\n', b' '))
+    texts.append(TEST_EN_LATN_BAD_UTF8)
+    fd, path = tempfile.mkstemp()
+    try:
+      os.write(fd, b'\n'.join(texts))
+      os.close(fd)
+      for detector in cld2, cld2full:
+        langs, percents, reliable = detector.detect_file(path, isPlainText=True, threads=4)
+        self.assertEqual(len(texts), len(langs))
+        for i, text in enumerate(texts[:-1]):
+          isReliable, textBytesFound, details = detector.detect(text, isPlainText=True)
+          self.assertEqual(details[0][:2], detector.LANGUAGES_BY_ID[langs[i]])
+          self.assertEqual(details[0][2], percents[i])
+          self.assertEqual(int(isReliable), reliable[i])
+        self.assertEqual(-1, reliable[-1])
+        self.assertRaises(ValueError, detector.detect_file, path, threads=-1)
+    finally:
+      os.remove(path)
+
+  def test_detect_column(self):
+    import array
+    texts = []
+    for lang, text in testData:
+      if not isinstance(text, bytes):
+        text = text.encode('utf-8')
+      texts.append(text)
+    texts.append(b'')
+    texts.append(TEST_EN_LATN_BAD_UTF8)
+    data = b''.join(texts)
+    offsets = [0]
+    for text in texts:
+      offsets.append(offsets[-1] + len(text))
+
+    for detector in cld2, cld2full:
+      for typecode in 'i', 'q':
+        langs = array.array('H', [0] * len(texts))
+        percents = array.array('B', [0] * len(texts))
+        reliable = array.array('b', [0] * len(texts))
+        self.assertEqual(len(texts), detector.detect_column(data, array.array(typecode, offsets), langs,
+                                                            percents, reliable, isPlainText=True, threads=4))
+        for i, text in enumerate(texts[:-1]):
+          isReliable, textBytesFound, details = detector.detect(text, isPlainText=True)
+          self.assertEqual(details[0][:2], detector.LANGUAGES_BY_ID[langs[i]])
+          self.assertEqual(details[0][2], percents[i])
+          self.assertEqual(1 if isReliable else 0, reliable[i])
+        self.assertEqual(-1, reliable[-1])
+
+      # Raw offset bytes, as in a pyarrow Buffer, and only languages:
+      langs2 = array.array('H', [0] * len(texts))
+      rawOffsets = array.array('i', offsets).tobytes()
+      detector.detect_column(data, rawOffsets, langs2, offsetWidth=4)
+      self.assertEqual(langs, langs2)
+      self.assertRaises(TypeError, detector.detect_column, data, rawOffsets, langs2)
+
+      # Outputs by keyword, and languages= narrows the results as it
+      # does for detect():
+      langs3 = array.array('H', [0] * len(texts))
+      detector.detect_column(data=data, offsets=array.array('i', offsets), outLanguages=langs3,
+                             isPlainText=True, languages=['en', 'fr'])
+      for i, text in enumerate(texts[:-1]):
+        details = detector.detect(text, isPlainText=True, languages=['en', 'fr'])[2]
+        self.assertEqual(details[0][:2], detector.LANGUAGES_BY_ID[langs3[i]])
+      self.assertRaises(ValueError, detector.detect_column, data, array.array('i', offsets), langs2, threads=-1)
+
+      self.assertRaises(ValueError, detector.detect_column, data, array.array('i', [0, 5, 3]), langs2)
+      self.assertRaises(ValueError, detector.detect_column, data, array.array('i', [0, len(data) + 1]), langs2)
+      self.assertRaises(ValueError, detector.detect_column, data, array.array('i', offsets), array.array('H', [0]))
+      self.assertRaises(TypeError, detector.detect_column, data, array.array('i', offsets), array.array('i', langs2))
+      self.assertRaises(BufferError, detector.detect_column, data, array.array('i', offsets), bytes(2 * len(texts)))
+
+  def test_hints(self):
+    for detector in cld2, cld2full:
+      hints = detector.Hints(hintTopLevelDomain='id', hintLanguage='it',
+                             hintLanguageHTTPHeaders='mi,en', hintEncoding='UTF8')
+      for lang, text in testData:
+        self.assertEqual(detector.detect(text, hintTopLevelDomain='id', hintLanguage='it',
+                                         hintLanguageHTTPHeaders='mi,en', hintEncoding='UTF8'),
+                         detector.detect(text, hints=hints))
+      for langHint in cld2.LANGUAGES:
+        detector.Hints(hintLanguage=langHint[0])
+        detector.Hints(hintLanguage=langHint[1])
+      for encoding in cld2.ENCODINGS:
+        detector.Hints(hintEncoding=encoding.lower())
+      self.assertRaises(detector.error, detector.Hints, hintLanguage='NOT_A_LANGUAGE')
+      self.assertRaises(detector.error, detector.Hints, hintEncoding='NOT_AN_ENCODING')
+      self.assertRaises(TypeError, detector.detect, fr_en_Latn, hints=hints, hintLanguage='it')
+      # Hints in use by other calls cannot be changed under them:
+      expected = detector.detect(fr_en_Latn, hints=hints)
+      self.assertRaises(RuntimeError, hints.__init__, hintTopLevelDomain='fr')
+      self.assertEqual(expected, detector.detect(fr_en_Latn, hints=hints))
+
+  def test_languages(self):
+    for detector in cld2, cld2full:
+      full = detector.detect(fr_en_Latn, returnVectors=True)
+      codes = [detail.languageCode for detail in full.details if detail.languageCode != 'un']
+      self.assertEqual(full, detector.detect(fr_en_Latn, returnVectors=True, languages=codes))
+
+      top = full.details[0]
+      restricted = detector.detect(fr_en_Latn, returnVectors=True, languages=codes[1:] + ['de'])
+      self.assertFalse(restricted.isReliable)
+      self.assertEqual(tuple(full.details[1:]), restricted.details[:len(full.details) - 1])
+      self.assertEqual(restricted.details[-1].languageCode, 'un')
+      self.assertEqual([vector[:2] for vector in full.vectors],
+                       [vector[:2] for vector in restricted.vectors])
+      for vector in restricted.vectors:
+        self.assertNotEqual(vector[3], top.languageCode)
+
+      hints = detector.Hints(languages=[top.languageName])
+      self.assertEqual(detector.detect(fr_en_Latn, languages=[top.languageName]),
+                       detector.detect(fr_en_Latn, hints=hints))
+      self.assertEqual([detector.detect(fr_en_Latn, hints=hints)],
+                       detector.detect_batch([fr_en_Latn], hints=hints))
+      self.assertRaises(detector.error, detector.detect, fr_en_Latn, languages=['NOT_A_LANGUAGE'])
+      self.assertRaises(TypeError, detector.detect, fr_en_Latn, languages='en')
+      self.assertRaises(ValueError, detector.detect, fr_en_Latn, languages=[])
+      self.assertRaises(TypeError, detector.detect, fr_en_Latn, hints=hints, languages=['en'])
+
+  def test_encoding(self):
+    russian = dict(testData)['RUSSIAN']
+    if isinstance(russian, bytes):
+      # Python 2
+      russian = russian.decode('utf-8')
+    for detector in cld2, cld2full:
+      for name, codec in (('RUSSIAN_CP1251', 'cp1251'), ('RUSSIAN_KOI8_R', 'koi8_r'), ('UTF16LE', 'utf-16-le')):
+        # The source encoding is also the default encoding hint:
+        expected = detector.detect(russian.encode('utf-8'), hintEncoding=name, returnVectors=True)
+        encoded = russian.encode(codec)
+        self.assertEqual(expected, detector.detect(encoded, encoding=name, returnVectors=True))
+        self.assertEqual([expected], detector.detect_batch([encoded], encoding=name, returnVectors=True))
+        self.assertEqual(expected, detector.detect(encoded, encoding=name, returnVectors=True, threads=2))
+
+      bad = russian.encode('utf-16-le') + b'\x00'
+      self.assertRaises(detector.error, detector.detect, bad, encoding='UTF16LE')
+      self.assertEqual(detector.detect(bad, encoding='UTF16LE', invalidUTF8='skip'),
+                       detector.detect(russian.encode('utf-8'), hintEncoding='UTF16LE'))
+      # An unpaired surrogate is one bad code unit; the rest of the
+      # input still decodes in step:
+      half = len(russian) // 2
+      bad = russian[:half].encode('utf-16-le') + b'\x00\xd8' + russian[half:].encode('utf-16-le')
+      repaired = russian[:half] + u'\ufffd' + russian[half:]
+      self.assertEqual(detector.detect(repaired.encode('utf-8'), hintEncoding='UTF16LE', returnVectors=True),
+                       detector.detect(bad, encoding='UTF16LE', invalidUTF8='replace', returnVectors=True))
+      # Text after the surrogate is still read as the text it is, not
+      # as code units shifted by a byte:
+      french = [text for lang, text in testData if lang == 'FRENCH'][0]
+      if isinstance(french, bytes):
+        french = french.decode('utf-8')
+      bad = b'\x00\xd8' + french.encode('utf-16-le')
+      for mode in 'replace', 'skip':
+        isReliable, textBytesFound, details = detector.detect(bad, encoding='UTF16LE', invalidUTF8=mode)
+        self.assertEqual('FRENCH', details[0][0])
+        self.assertTrue(textBytesFound >= len(french))
+      self.assertRaises(detector.error, detector.detect, russian, encoding='NOT_AN_ENCODING')
+      self.assertRaises(ValueError, detector.detect, russian, encoding='BINARYENC')
+
+  def test_result_fields(self):
+    for detector in cld2, cld2full:
+      result = detector.detect(fr_en_Latn, returnVectors=True)
+      isReliable, textBytesFound, details, vectors = result
+      self.assertTrue(isinstance(result, detector.DetectionResultWithVectors))
+      self.assertEqual(isReliable, result.isReliable)
+      self.assertEqual(textBytesFound, result.textBytesFound)
+      self.assertEqual(vectors, result.vectors)
+      for detail in result.details:
+        self.assertEqual(detail, (detail.languageName, detail.languageCode, detail.percent, detail.score))
+      self.assertTrue(isinstance(detector.detect(fr_en_Latn), detector.DetectionResult))
+
+  def test_pickle_results(self):
+    for detector in cld2, cld2full:
+      plain = detector.detect(b'hello world this is english text')
+      withVectors = detector.detect(fr_en_Latn, returnVectors=True)
+      traced = detector.detect(fr_en_Latn, traceEvery=1)
+      for result in plain, withVectors, traced:
+        for clone in pickle.loads(pickle.dumps(result)), copy.copy(result), copy.deepcopy(result):
+          self.assertEqual(type(result), type(clone))
+          self.assertEqual(result, clone)
+          self.assertEqual(result.bytesScored, clone.bytesScored)
+          self.assertEqual(result.trace, clone.trace)
+      # Hidden fields that do not apply are None:
+      self.assertTrue(plain.vectors is None)
+      self.assertTrue(plain.trace is None)
+
+  def test_columnar_vectors(self):
+    for detector in cld2, cld2full:
+      for lang, text in testData:
+        vectors = detector.detect(text, returnVectors=True).vectors
+        columns = detector.detect(text, columnarVectors=True).vectors
+        self.assertEqual(len(vectors), len(columns.offsets))
+        for vector, offset, length, langID in zip(vectors, columns.offsets, columns.lengths, columns.languages):
+          self.assertEqual(vector, (offset, length) + detector.LANGUAGES_BY_ID[langID])
+        # Exposed through the buffer protocol:
+        self.assertEqual(4 * len(vectors), len(memoryview(columns.offsets).tobytes()))
+
+  def test_max_bytes(self):
+    text = 'The quick brown fox jumps over the lazy dog. ' * 2000
+    for detector in cld2, cld2full:
+      full = detector.detect(text)
+      self.assertEqual(len(text), full.bytesScored)
+      sampled = detector.detect(text, maxBytes=6000, returnVectors=True)
+      self.assertTrue(0 < sampled.bytesScored <= 6000)
+      self.assertEqual(full.details[0].languageCode, sampled.details[0].languageCode)
+      for offset, length, name, code in sampled.vectors:
+        self.assertTrue(offset + length <= len(text))
+      # Shorter texts are scored whole:
+      self.assertEqual(full, detector.detect(text, maxBytes=len(text)))
+      self.assertRaises(ValueError, detector.detect, text, maxBytes=-1)
+      # Invalid UTF-8 inside a scored window is still reported:
+      if sys.version_info >= (3,):
+        self.assertRaises(detector.error, detector.detect, b'\xff' + text.encode('utf-8'), maxBytes=6000)
+
+  def test_trace(self):
+    text = fr_en_Latn
+    if not isinstance(text, bytes):
+      text = text.encode('utf-8')
+    long_text = 'The quick brown fox jumps over the lazy dog. ' * 2000
+    for detector in cld2, cld2full:
+      plain = detector.detect(fr_en_Latn, returnVectors=True)
+      self.assertTrue(plain.trace is None)
+      traced = detector.detect(fr_en_Latn, returnVectors=True, traceEvery=1)
+      # Tracing does not change the result:
+      self.assertEqual(plain, traced)
+      trace = traced.trace
+      self.assertTrue(isinstance(trace, detector.Trace))
+      self.assertEqual(1, len(trace.passes))
+      self.assertTrue(trace.seconds >= trace.passes[0].seconds >= 0)
+      tracePass = trace.passes[0]
+      self.assertEqual((0, len(text)), (tracePass.offset, tracePass.bytes))
+      self.assertEqual(len(traced.vectors), len(tracePass.chunks))
+      for vector, chunk in zip(traced.vectors, tracePass.chunks):
+        self.assertTrue(isinstance(chunk, detector.TraceChunk))
+        self.assertEqual((vector[0], vector[1], vector[3]), (chunk.offset, chunk.bytes, chunk.languageCode))
+        self.assertEqual('Latn', chunk.script)
+        self.assertEqual(3, len(chunk.candidates))
+        self.assertTrue(isinstance(chunk.candidates[0], detector.LanguageDetail))
+
+      # One call in three, per thread:
+      traced = [detector.detect(fr_en_Latn, traceEvery=3).trace is not None for i in range(6)]
+      self.assertEqual(2, sum(traced))
+      self.assertEqual(traced[:3], traced[3:])
+      traced = [r.trace is not None for r in detector.detect_batch([fr_en_Latn] * 6, traceEvery=2)]
+      self.assertEqual(3, sum(traced))
+      self.assertEqual(traced[:2] * 3, traced)
+
+      # Each maxBytes window is a pass of its own:
+      trace = detector.detect(long_text, maxBytes=6000, traceEvery=1).trace
+      self.assertTrue(len(trace.passes) >= 2)
+      for tracePass in trace.passes:
+        self.assertTrue(tracePass.offset + tracePass.bytes <= len(long_text))
+        for chunk in tracePass.chunks:
+          self.assertTrue(chunk.offset + chunk.bytes <= tracePass.bytes)
+
+  def test_stats(self):
+    for detector in cld2, cld2full:
+      detector.reset_stats()
+      text = 'The quick brown fox jumps over the lazy dog. ' * 10
+      detector.detect(text)
+      detector.detect_batch([text, text])
+      self.assertRaises(detector.error, detector.detect, b'\xff\xfe abc')
+      # A document fed in pieces is one call, like any other input:
+      d = detector.Detector()
+      for i in range(0, len(text), 100):
+        d.feed(text[i:i+100])
+      d.finish()
+      stats = detector.stats()
+      # One call per input, so calls is documents plus invalid inputs:
+      self.assertEqual(5, stats['calls'])
+      self.assertEqual(4, stats['documents'])
+      self.assertEqual(4 * len(text) + 6, stats['bytes'])
+      self.assertEqual(1, stats['invalidUTF8'])
+      self.assertEqual(4, stats['languages']['en'])
+      self.assertEqual(5, sum(count for bound, count in stats['detectTimeHistogram']))
+      detector.reset_stats()
+      self.assertEqual(0, detector.stats()['calls'])
+
+  def test_load_tables(self):
+    # These builds have their tables compiled in:
+    for detector in cld2, cld2full:
+      self.assertRaises(detector.error, detector.load_tables, 'cld2_data.bin')
+
+  def test_tables(self):
+    self.assertEqual('small', cld2.TABLES)
+    self.assertEqual('full', cld2full.TABLES)
+    self.assertEqual(cld2.DETECTED_LANGUAGES, cld2.DETECTED_LANGUAGES_BY_TABLES['small'])
+    self.assertEqual(cld2full.DETECTED_LANGUAGES, cld2.DETECTED_LANGUAGES_BY_TABLES['full'])
+    for lang, text in testData[:20]:
+      # Either module can detect with either table set:
+      self.assertEqual(tuple(cld2full.detect(text)), tuple(cld2.detect(text, tables='full')))
+      self.assertEqual(tuple(cld2.detect(text)), tuple(cld2full.detect(text, tables='small')))
+    self.assertRaises(ValueError, cld2.detect, 'text', tables='medium')
+
+  def test_cache(self):
+    for detector in cld2, cld2full:
+      detector.set_cache(100, maxBytes=64)
+      try:
+        before = detector.cache_stats()
+        short = 'Buy now: blue cotton shirt'
+        first = detector.detect(short, returnVectors=True)
+        self.assertEqual(first, detector.detect(short, returnVectors=True))
+        # Different options are cached separately:
+        self.assertEqual(detector.detect(short), detector.detect(short))
+        # Too long to cache:
+        detector.detect(short * 10)
+        after = detector.cache_stats()
+        self.assertEqual(2, after['hits'] - before['hits'])
+        self.assertEqual(2, after['misses'] - before['misses'])
+        self.assertEqual(2, after['entries'])
+      finally:
+        detector.set_cache(0)
+      self.assertEqual(0, detector.cache_stats()['entries'])
+
+      # The largest size splits into shards without overflowing:
+      detector.set_cache(2**31 - 1)
+      try:
+        short = 'Buy now: blue cotton shirt'
+        self.assertEqual(detector.detect(short), detector.detect(short))
+        self.assertEqual(1, detector.cache_stats()['entries'])
+        self.assertEqual(2**31 - 1, detector.cache_stats()['maxEntries'])
+      finally:
+        detector.set_cache(0)
+      for maxEntries in -1, 2**31, 2**80:
+        self.assertRaises(ValueError, detector.set_cache, maxEntries)
+
+  def test_parallel_detect(self):
+    for detector in cld2, cld2full:
+      for lang, text in testData[:5]:
+        text = ' '.join([text] * (300000 // len(text) + 1))
+        single = detector.detect(text, returnVectors=True)
+        parallel = detector.detect(text, returnVectors=True, threads=4)
+        self.assertEqual(single.details[0].languageCode, parallel.details[0].languageCode)
+        self.assertTrue(abs(single.textBytesFound - parallel.textBytesFound) <= single.textBytesFound // 100)
+        # Vectors are in order, with offsets into the whole text:
+        offsets = [vector[0] for vector in parallel.vectors]
+        self.assertEqual(sorted(offsets), offsets)
+        self.assertTrue(offsets[-1] < len(text.encode('utf-8')))
+
+  def test_fork(self):
+    if not hasattr(os, 'fork'):
+      return
+    import signal
+    import threading
+    import warnings
+    texts = [text for lang, text in testData[:20]]
+    for detector in cld2, cld2full:
+      expected = detector.detect_batch(texts, threads=4)
+      # Fork while another thread keeps using the worker pool; the child
+      # gets a pool of its own instead of waiting on the parent's:
+      stop = threading.Event()
+      def busy():
+        while not stop.is_set():
+          detector.detect_batch(texts, threads=4)
+      thread = threading.Thread(target=busy)
+      thread.start()
+      try:
+        for i in range(5):
+          with warnings.catch_warnings():
+            warnings.simplefilter('ignore', DeprecationWarning)
+            pid = os.fork()
+          if pid == 0:
+            signal.alarm(30)
+            ok = detector.detect_batch(texts, threads=4) == expected
+            os._exit(0 if ok else 1)
+          self.assertEqual(0, os.waitpid(pid, 0)[1])
+      finally:
+        stop.set()
+        thread.join()
+
+  def test_detect_async(self):
+    if sys.version_info < (3, 7):
+      return
+    import asyncio
+
+    async def detectAll(detector, texts):
+      return await asyncio.gather(*[detector.detect_async(text, bestEffort=True) for text in texts])
+
+    texts = [text for lang, text in testData[:20]]
+    for detector in cld2, cld2full:
+      expected = [detector.detect(text, bestEffort=True) for text in texts]
+      self.assertEqual(expected, asyncio.run(detectAll(detector, texts)))
+      # Each run gets a new event loop:
+      self.assertEqual(expected, asyncio.run(detectAll(detector, texts)))
+
+      async def detectInvalid():
+        return await detector.detect_async(b'\xff\xfe abc')
+      self.assertRaises(detector.error, asyncio.run, detectInvalid())
+
+      # Needs a running event loop:
+      self.assertRaises(RuntimeError, detector.detect_async, 'hello')
+
+      # A batch does not wait for helpers queued behind a backlog of
+      # async jobs once it has detected every input itself:
+      async def batchBehindBacklog(big, jobs):
+        before = detector.stats()['bytes']
+        futures = [detector.detect_async(big) for i in range(jobs)]
+        detector.detect_batch(['hello world'] * 10, threads=4)
+        asyncBytes = detector.stats()['bytes'] - before - 10 * len('hello world')
+        await asyncio.gather(*futures)
+        return asyncBytes // len(big)
+      big = ' '.join(text for lang, text in testData if lang == 'ENGLISH') * 200
+      self.assertTrue(asyncio.run(batchBehindBacklog(big, 50)) < 50)
+
+  def test_isolation(self):
+    import sysconfig
+    if sysconfig.get_config_var('Py_GIL_DISABLED'):
+      # Importing the modules did not turn the GIL back on:
+      self.assertFalse(sys._is_gil_enabled())
+
+    # Interpreters with their own GIL each import their own copy:
+    try:
+      if sys.version_info >= (3, 13):
+        import _interpreters as interpreters
+      elif sys.version_info >= (3, 12):
+        import _xxsubinterpreters as interpreters
+      else:
+        return
+    except ImportError:
+      return
+    text = testData[0][1]
+    code = '\n'.join([
+      'import sys',
+      'sys.path.insert(0, %r)' % os.path.abspath(moduleDir),
+      'import cld2, cld2full',
+      'assert repr(cld2.detect(%r)) == %r' % (text, repr(cld2.detect(text))),
+      'assert repr(cld2full.detect(%r)) == %r' % (text, repr(cld2full.detect(text)))])
+    if sys.version_info >= (3, 13):
+      interp = interpreters.create()
+      self.assertEqual(None, interpreters.run_string(interp, code))
+    else:
+      interp = interpreters.create(isolated=True)
+      interpreters.run_string(interp, code)
+    interpreters.destroy(interp)
+
 if __name__ == '__main__':
   try:
     unittest.main()
@@ -0,0 +1,101 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <random>
+#include "detect.h"
+#include "getonescriptspan.h"
+#include "lang_script.h"
+#include "trace.h"
+
+// The debug flags only write HTML to stderr; re-detecting a chunk for
+// its candidates never passes them on:
+static const int kDebugFlags = CLD2::kCLDFlagHtml | CLD2::kCLDFlagCr | CLD2::kCLDFlagVerbose |
+  CLD2::kCLDFlagQuiet | CLD2::kCLDFlagEcho;
+
+const char *TraceScript(const char *bytes, int numBytes, bool isPlainText) {
+  // Bytes of letters per script, split into spans as CLD2 itself
+  // splits text before scoring it:
+  int counts[CLD2::NUM_ULSCRIPTS] = {0};
+  CLD2::ScriptScanner scanner(bytes, numBytes, isPlainText);
+  CLD2::LangSpan span;
+  while (scanner.GetOneScriptSpan(&span)) {
+    if (span.ulscript < CLD2::NUM_ULSCRIPTS) {
+      counts[span.ulscript] += span.text_bytes;
+    }
+  }
+  CLD2::ULScript best = CLD2::ULScript_Common;
+  int bestCount = 0;
+  for(int s=0;s<CLD2::NUM_ULSCRIPTS;s++) {
+    if (counts[s] > bestCount) {
+      best = static_cast<CLD2::ULScript>(s);
+      bestCount = counts[s];
+    }
+  }
+  return CLD2::ULScriptCode(best);
+}
+
+DetectTrace::DetectTrace()
+  : nanos(0), nextPassOffset(0) {
+}
+
+void DetectTrace::AddPass(const char *bytes, int numBytes, const DetectOptions &opts,
+                          const CLD2::ResultChunkVector &resultChunks, uint64_t passNanos) {
+  TracePass pass;
+  pass.offset = nextPassOffset;
+  pass.bytes = numBytes;
+  pass.nanos = passNanos;
+  pass.firstChunk = (int) chunks.size();
+  pass.numChunks = 0;
+  nextPassOffset = 0;
+
+  DetectFunction detect = opts.detect != 0 ? opts.detect : CLD2::ExtDetectLanguageSummaryCheckUTF8;
+  for(unsigned int i=0;i<resultChunks.size();i++) {
+    const CLD2::ResultChunk &chunk = resultChunks[i];
+    if (chunk.offset < 0 || chunk.offset + chunk.bytes > numBytes) {
+      continue;
+    }
+    TraceChunk traced;
+    traced.offset = chunk.offset;
+    traced.bytes = chunk.bytes;
+    traced.script = TraceScript(bytes + chunk.offset, chunk.bytes, opts.isPlainText);
+    traced.language = static_cast<CLD2::Language>(chunk.lang1);
+    int textBytes;
+    bool isReliable;
+    int validPrefixBytes;
+    detect(bytes + chunk.offset, chunk.bytes,
+           opts.isPlainText,
+           &opts.cldHints,
+           opts.flags & ~kDebugFlags,
+           traced.language3,
+           traced.percent3,
+           traced.normalized_score3,
+           0,
+           &textBytes,
+           &isReliable,
+           &validPrefixBytes);
+    chunks.push_back(traced);
+    pass.numChunks++;
+  }
+  passes.push_back(pass);
+}
+
+bool TraceSampled(int every) {
+  if (every <= 0) {
+    return false;
+  }
+  // Each thread starts at a random phase, so a pool of new threads does
+  // not all trace their first call:
+  static thread_local unsigned int calls = std::random_device()();
+  return calls++ % (unsigned int) every == 0;
+}
@@ -0,0 +1,89 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Structured, in-memory traces of single detections, in place of the
+// HTML CLD2's debug flags write to stderr.  Only sampled calls are
+// traced (see TraceSampled), and only they pay for it.
+
+#ifndef PYCLD_TRACE_H_
+#define PYCLD_TRACE_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "compact_lang_det.h"
+
+struct DetectOptions;
+
+// One chunk CLD2 reported, with the top three languages CLD2 gives that
+// chunk's text on its own:
+struct TraceChunk {
+  int offset;
+  int bytes;
+  // ISO 15924 code of the chunk's most common script, e.g. "Latn":
+  const char *script;
+  CLD2::Language language;
+  CLD2::Language language3[3];
+  int percent3[3];
+  double normalized_score3[3];
+};
+
+// One call into CLD2: the whole text, or one window or piece of it.
+// Chunk offsets are relative to the pass's own text:
+struct TracePass {
+  // Where the pass's text starts in the input (or in the converted or
+  // scrubbed copy detected instead of it):
+  int offset;
+  int bytes;
+  uint64_t nanos;
+  int firstChunk;
+  int numChunks;
+};
+
+class DetectTrace {
+ public:
+  DetectTrace();
+
+  // The next pass starts this far into the input, rather than at 0;
+  // see DetectSampled:
+  void SetNextPassOffset(int offset) {
+    nextPassOffset = offset;
+  }
+
+  // Records one CLD2 call over bytes[0..numBytes), which took nanos and
+  // reported chunks, and re-detects each chunk alone for its
+  // candidates:
+  void AddPass(const char *bytes, int numBytes, const DetectOptions &opts,
+               const CLD2::ResultChunkVector &chunks, uint64_t nanos);
+
+  std::vector<TracePass> passes;
+  std::vector<TraceChunk> chunks;
+  // The whole call, set by its caller:
+  uint64_t nanos;
+
+ private:
+  int nextPassOffset;
+};
+
+// True for one in every calls made on this thread, from a random
+// starting point; 0 never traces and 1 always does.  Each thread counts
+// on its own, so sampling costs no shared write:
+bool TraceSampled(int every);
+
+// ISO 15924 code of the script with the most letters in
+// bytes[0..numBytes), which must be valid UTF-8, as CLD2's own script
+// spans (CLD2::ScriptScanner) divide it, or "Zyyy" if there are none:
+const char *TraceScript(const char *bytes, int numBytes, bool isPlainText);
+
+#endif  // PYCLD_TRACE_H_
@@ -0,0 +1,243 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <errno.h>
+#include <iconv.h>
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#include "transcode.h"
+
+// iconv's names for the CLD2 encodings it can read; encodings not
+// listed here (font encodings, BINARYENC, ...) cannot be transcoded:
+static const struct {
+  CLD2::Encoding encoding;
+  const char *iconvName;
+} kIconvNames[] = {
+  {CLD2::ISO_8859_1, "ISO-8859-1"},
+  {CLD2::ISO_8859_2, "ISO-8859-2"},
+  {CLD2::ISO_8859_3, "ISO-8859-3"},
+  {CLD2::ISO_8859_4, "ISO-8859-4"},
+  {CLD2::ISO_8859_5, "ISO-8859-5"},
+  {CLD2::ISO_8859_6, "ISO-8859-6"},
+  {CLD2::ISO_8859_7, "ISO-8859-7"},
+  {CLD2::ISO_8859_8, "ISO-8859-8"},
+  {CLD2::ISO_8859_9, "ISO-8859-9"},
+  {CLD2::ISO_8859_10, "ISO-8859-10"},
+  {CLD2::ISO_8859_11, "ISO-8859-11"},
+  {CLD2::ISO_8859_13, "ISO-8859-13"},
+  {CLD2::ISO_8859_15, "ISO-8859-15"},
+  {CLD2::ISO_8859_8_I, "ISO-8859-8"},
+  {CLD2::HEBREW_VISUAL, "ISO-8859-8"},
+  {CLD2::JAPANESE_EUC_JP, "EUC-JP"},
+  {CLD2::JAPANESE_SHIFT_JIS, "SHIFT_JIS"},
+  {CLD2::JAPANESE_JIS, "ISO-2022-JP"},
+  {CLD2::JAPANESE_CP932, "CP932"},
+  {CLD2::KDDI_SHIFT_JIS, "CP932"},
+  {CLD2::DOCOMO_SHIFT_JIS, "CP932"},
+  {CLD2::SOFTBANK_SHIFT_JIS, "CP932"},
+  {CLD2::KDDI_ISO_2022_JP, "ISO-2022-JP"},
+  {CLD2::SOFTBANK_ISO_2022_JP, "ISO-2022-JP"},
+  {CLD2::CHINESE_BIG5, "BIG5"},
+  {CLD2::CHINESE_BIG5_CP950, "CP950"},
+  {CLD2::BIG5_HKSCS, "BIG5-HKSCS"},
+  {CLD2::CHINESE_GB, "GB2312"},
+  {CLD2::CHINESE_EUC_CN, "EUC-CN"},
+  {CLD2::CHINESE_CNS, "EUC-TW"},
+  {CLD2::GBK, "GBK"},
+  {CLD2::GB18030, "GB18030"},
+  {CLD2::ISO_2022_CN, "ISO-2022-CN"},
+  {CLD2::KOREAN_EUC_KR, "EUC-KR"},
+  {CLD2::ISO_2022_KR, "ISO-2022-KR"},
+  {CLD2::RUSSIAN_KOI8_R, "KOI8-R"},
+  {CLD2::RUSSIAN_KOI8_RU, "KOI8-RU"},
+  {CLD2::RUSSIAN_CP1251, "CP1251"},
+  {CLD2::RUSSIAN_CP866, "CP866"},
+  {CLD2::MSFT_CP1250, "CP1250"},
+  {CLD2::MSFT_CP1252, "CP1252"},
+  {CLD2::MSFT_CP1253, "CP1253"},
+  {CLD2::MSFT_CP1254, "CP1254"},
+  {CLD2::MSFT_CP1255, "CP1255"},
+  {CLD2::MSFT_CP1256, "CP1256"},
+  {CLD2::MSFT_CP1257, "CP1257"},
+  {CLD2::MSFT_CP874, "CP874"},
+  {CLD2::CZECH_CP852, "CP852"},
+  {CLD2::CZECH_CSN_369103, "CSN_369103"},
+  {CLD2::TSCII, "TSCII"},
+  {CLD2::MACINTOSH_ROMAN, "MACINTOSH"},
+  {CLD2::UTF7, "UTF-7"},
+  {CLD2::UTF16BE, "UTF-16BE"},
+  {CLD2::UTF16LE, "UTF-16LE"},
+  {CLD2::UTF32BE, "UTF-32BE"},
+  {CLD2::UTF32LE, "UTF-32LE"},
+};
+
+static const char *
+IconvName(CLD2::Encoding encoding) {
+  for(unsigned int i=0;i<sizeof(kIconvNames)/sizeof(kIconvNames[0]);i++) {
+    if (kIconvNames[i].encoding == encoding) {
+      return kIconvNames[i].iconvName;
+    }
+  }
+  return 0;
+}
+
+// How many bytes to skip past an invalid sequence: one code unit, so
+// fixed-width input stays aligned after the error:
+static size_t
+CodeUnitBytes(CLD2::Encoding encoding) {
+  switch (encoding) {
+  case CLD2::UTF16BE:
+  case CLD2::UTF16LE:
+    return 2;
+  case CLD2::UTF32BE:
+  case CLD2::UTF32LE:
+    return 4;
+  default:
+    return 1;
+  }
+}
+
+// This thread's converters, opened on first use and closed when the
+// thread exits:
+class Converters {
+ public:
+  Converters() {
+    for(int i=0;i<CLD2::NUM_ENCODINGS;i++) {
+      converters[i] = (iconv_t) -1;
+    }
+  }
+
+  ~Converters() {
+    for(int i=0;i<CLD2::NUM_ENCODINGS;i++) {
+      if (converters[i] != (iconv_t) -1) {
+        iconv_close(converters[i]);
+      }
+    }
+  }
+
+  // Returns (iconv_t) -1, with errno set, if encoding cannot be read:
+  iconv_t Get(CLD2::Encoding encoding) {
+    if (encoding < 0 || encoding >= CLD2::NUM_ENCODINGS) {
+      errno = EINVAL;
+      return (iconv_t) -1;
+    }
+    if (converters[encoding] == (iconv_t) -1) {
+      const char *name = IconvName(encoding);
+      if (name == 0) {
+        errno = EINVAL;
+        return (iconv_t) -1;
+      }
+      converters[encoding] = iconv_open("UTF-8", name);
+    }
+    return converters[encoding];
+  }
+
+ private:
+  iconv_t converters[CLD2::NUM_ENCODINGS];
+};
+
+static Converters &
+ThreadConverters() {
+  static thread_local Converters converters;
+  return converters;
+}
+
+bool NeedsTranscoding(CLD2::Encoding encoding) {
+  return encoding != CLD2::UTF8 && encoding != CLD2::ASCII_7BIT;
+}
+
+bool CanTranscode(CLD2::Encoding encoding, std::string *error) {
+  if (!NeedsTranscoding(encoding)) {
+    return true;
+  }
+  const char *name = IconvName(encoding);
+  if (name == 0) {
+    *error = "this encoding cannot be converted to UTF-8";
+    return false;
+  }
+  if (ThreadConverters().Get(encoding) == (iconv_t) -1) {
+    *error = std::string("iconv cannot convert from ") + name + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool TranscodeToUTF8(CLD2::Encoding encoding, const char *bytes, int numBytes,
+                     bool stopOnError, bool replace, std::string *out, int *badOffset) {
+  out->clear();
+  iconv_t cd = ThreadConverters().Get(encoding);
+  if (cd == (iconv_t) -1) {
+    *badOffset = 0;
+    return false;
+  }
+  // Back to the initial shift state, in case the last call stopped
+  // part way:
+  iconv(cd, 0, 0, 0, 0);
+
+  // Most legacy text grows by at most half as UTF-8; doubled as needed:
+  out->resize((size_t) numBytes + numBytes / 2 + 16);
+  char *in = (char *) bytes;
+  size_t inLeft = numBytes;
+  size_t used = 0;
+  size_t unitBytes = CodeUnitBytes(encoding);
+  while (inLeft > 0) {
+    char *dst = &(*out)[used];
+    size_t dstLeft = out->size() - used;
+    size_t ret = iconv(cd, &in, &inLeft, &dst, &dstLeft);
+    int error = errno;
+    used = dst - out->data();
+    if (ret != (size_t) -1) {
+      continue;
+    }
+    if (error == E2BIG) {
+      out->resize(out->size() * 2);
+      continue;
+    }
+    // EILSEQ, or EINVAL for a sequence cut off by the end of input:
+    if (stopOnError) {
+      *badOffset = (int) (in - bytes);
+      return false;
+    }
+    if (replace) {
+      if (out->size() - used < 3) {
+        out->resize(out->size() * 2);
+      }
+      memcpy(&(*out)[used], "\xEF\xBF\xBD", 3);
+      used += 3;
+    }
+    size_t skip = std::min(unitBytes, inLeft);
+    in += skip;
+    inLeft -= skip;
+  }
+
+  // Write whatever ends the shift state:
+  while (true) {
+    char *dst = &(*out)[used];
+    size_t dstLeft = out->size() - used;
+    size_t ret = iconv(cd, 0, 0, &dst, &dstLeft);
+    used = dst - out->data();
+    if (ret != (size_t) -1 || errno != E2BIG) {
+      break;
+    }
+    out->resize(out->size() * 2);
+  }
+
+  out->resize(used);
+  if (used > (size_t) INT_MAX) {
+    *badOffset = -1;
+    return false;
+  }
+  return true;
+}
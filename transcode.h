@@ -0,0 +1,41 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Converting text in one of CLD2's encodings to UTF-8, with iconv.
+// Converters are opened once per thread and encoding and then reused.
+
+#ifndef PYCLD_TRANSCODE_H_
+#define PYCLD_TRANSCODE_H_
+
+#include <string>
+
+#include "encodings.h"
+
+// True if text in encoding can be converted to UTF-8; if not, sets
+// *error to why.  UTF8 and ASCII_7BIT need no converting and are
+// always true.
+bool CanTranscode(CLD2::Encoding encoding, std::string *error);
+
+// True if text in encoding must be converted before CLD2 can read it:
+bool NeedsTranscoding(CLD2::Encoding encoding);
+
+// Sets *out to bytes[0..numBytes), converted from encoding to UTF-8.
+// If stopOnError, returns false at the first byte that is not valid in
+// encoding, setting *badOffset to its offset; otherwise each such byte
+// is replaced with U+FFFD (if replace) or dropped.  Also returns false,
+// with *badOffset at -1, if *out would be over 2 GB.
+bool TranscodeToUTF8(CLD2::Encoding encoding, const char *bytes, int numBytes,
+                     bool stopOnError, bool replace, std::string *out, int *badOffset);
+
+#endif  // PYCLD_TRANSCODE_H_
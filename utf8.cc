@@ -0,0 +1,188 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "utf8.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PYCLD_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Bytes 0x20..0x7E need no further checking:
+static inline bool
+IsPlainASCII(unsigned char c) {
+  return c >= 0x20 && c < 0x7F;
+}
+
+static int
+PlainASCIISpanScalar(const unsigned char *s, int n) {
+  int i = 0;
+  while (i < n && IsPlainASCII(s[i])) {
+    i++;
+  }
+  return i;
+}
+
+#ifdef PYCLD_X86_SIMD
+
+// As signed bytes, everything at or above 0x80 is negative, so one
+// signed compare against 0x20 finds both non-ASCII and control bytes;
+// DEL (0x7F) is checked separately.
+
+static int
+PlainASCIISpanSSE2(const unsigned char *s, int n) {
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  int i = 0;
+  for(;i+16<=n;i+=16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + PlainASCIISpanScalar(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int
+PlainASCIISpanAVX2(const unsigned char *s, int n) {
+  const __m256i space = _mm256_set1_epi8(0x20);
+  const __m256i del = _mm256_set1_epi8(0x7F);
+  int i = 0;
+  for(;i+32<=n;i+=32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + PlainASCIISpanSSE2(s + i, n - i);
+}
+
+static int (*ResolvePlainASCIISpan())(const unsigned char *, int) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? PlainASCIISpanAVX2 : PlainASCIISpanSSE2;
+}
+
+static inline int
+PlainASCIISpan(const unsigned char *s, int n) {
+  static int (*const span)(const unsigned char *, int) = ResolvePlainASCIISpan();
+  return span(s, n);
+}
+
+#else
+
+static inline int
+PlainASCIISpan(const unsigned char *s, int n) {
+  return PlainASCIISpanScalar(s, n);
+}
+
+#endif  // PYCLD_X86_SIMD
+
+static inline bool
+IsContinuation(unsigned char c) {
+  return (c & 0xC0) == 0x80;
+}
+
+// Returns the length of the valid character starting at s[0], or 0 if
+// there is none, setting *badLength to the length of the maximal
+// invalid subpart (at least 1) that starts there.
+static int
+CharLength(const unsigned char *s, int n, int *badLength) {
+  unsigned char c = s[0];
+  *badLength = 1;
+  if (c < 0x80) {
+    return IsPlainASCII(c) || c == '\t' || c == '\n' || c == '\f' || c == '\r' ? 1 : 0;
+  }
+  if (c < 0xC2 || c > 0xF4) {
+    return 0;
+  }
+
+  int length = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+  // The second byte's range rules out overlong forms, surrogates and
+  // code points above U+10FFFF:
+  unsigned char lo = c == 0xE0 ? 0xA0 : c == 0xF0 ? 0x90 : 0x80;
+  unsigned char hi = c == 0xED ? 0x9F : c == 0xF4 ? 0x8F : 0xBF;
+  if (n < 2 || s[1] < lo || s[1] > hi) {
+    return 0;
+  }
+  for(int i=2;i<length;i++) {
+    if (i >= n || !IsContinuation(s[i])) {
+      *badLength = i;
+      return 0;
+    }
+  }
+
+  unsigned int cp;
+  if (length == 2) {
+    cp = ((c & 0x1F) << 6) | (s[1] & 0x3F);
+  } else if (length == 3) {
+    cp = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+  } else {
+    cp = ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+  }
+  // C1 controls and noncharacters:
+  if (cp < 0xA0 || (cp >= 0xFDD0 && cp <= 0xFDEF) || (cp & 0xFFFE) == 0xFFFE) {
+    *badLength = length;
+    return 0;
+  }
+  return length;
+}
+
+int ValidUTF8Prefix(const char *bytes, int numBytes) {
+  const unsigned char *s = (const unsigned char *) bytes;
+  int i = 0;
+  while (true) {
+    i += PlainASCIISpan(s + i, numBytes - i);
+    if (i == numBytes) {
+      return i;
+    }
+    int badLength;
+    int length = CharLength(s + i, numBytes - i, &badLength);
+    if (length == 0) {
+      return i;
+    }
+    i += length;
+  }
+}
+
+void ScrubUTF8(const char *bytes, int numBytes, int validPrefixBytes, bool replace, std::string *out) {
+  const unsigned char *s = (const unsigned char *) bytes;
+  out->clear();
+  out->reserve(numBytes + (replace ? 16 : 0));
+  out->append(bytes, validPrefixBytes);
+  int i = validPrefixBytes;
+  while (i < numBytes) {
+    int start = i;
+    while (i < numBytes) {
+      i += PlainASCIISpan(s + i, numBytes - i);
+      int badLength;
+      int length = i < numBytes ? CharLength(s + i, numBytes - i, &badLength) : 0;
+      if (length == 0) {
+        break;
+      }
+      i += length;
+    }
+    out->append(bytes + start, i - start);
+    if (i < numBytes) {
+      int badLength;
+      CharLength(s + i, numBytes - i, &badLength);
+      if (replace) {
+        out->append("\xEF\xBF\xBD");
+      }
+      i += badLength;
+    }
+  }
+}
@@ -0,0 +1,37 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Checking and repairing UTF-8 the way CLD2 wants it: well-formed, and
+// "interchange valid", i.e. without control characters (other than tab,
+// newline, form feed and carriage return) or noncharacters, which CLD2
+// also rejects.
+
+#ifndef PYCLD_UTF8_H_
+#define PYCLD_UTF8_H_
+
+#include <string>
+
+// Length of the longest interchange-valid prefix of bytes[0..numBytes).
+// Runs of printable ASCII are skipped 16 (SSE2) or 32 (AVX2, if the CPU
+// has it) bytes at a time.
+int ValidUTF8Prefix(const char *bytes, int numBytes);
+
+// Sets *out to bytes[0..numBytes) with every invalid sequence replaced
+// by U+FFFD (if replace) or dropped.  As with Python's
+// errors='replace', each maximal ill-formed subpart becomes one U+FFFD;
+// each rejected control character or noncharacter does too.  The first
+// validPrefixBytes are known to be valid and are copied as is.
+void ScrubUTF8(const char *bytes, int numBytes, int validPrefixBytes, bool replace, std::string *out);
+
+#endif  // PYCLD_UTF8_H_
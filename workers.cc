@@ -0,0 +1,151 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <pthread.h>
+#include <atomic>
+#include <memory>
+#include "workers.h"
+
+WorkerPool::WorkerPool(int numThreads) : stopping(false) {
+  for(int i=0;i<numThreads;i++) {
+    threads.push_back(std::thread(&WorkerPool::Run, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    stopping = true;
+  }
+  cv.notify_all();
+  for(unsigned int i=0;i<threads.size();i++) {
+    threads[i].join();
+  }
+}
+
+void WorkerPool::Submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    tasks.push_back(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void WorkerPool::Run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mu);
+      cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void WorkerPool::ParallelFor(int count, int maxThreads, const std::function<void(int)> &fn) {
+  if (count <= 0) {
+    return;
+  }
+  if (maxThreads <= 0 || maxThreads > size() + 1) {
+    maxThreads = size() + 1;
+  }
+  if (maxThreads > count) {
+    maxThreads = count;
+  }
+
+  // Threads pull the next index until none are left, so one slow item
+  // does not hold up a whole pre-assigned slice.  Helpers may still be
+  // queued behind other tasks when the caller has finished every index,
+  // so they share this with the caller rather than its stack, and the
+  // caller waits only for helpers that had already started:
+  struct State {
+    std::atomic<int> next;
+    std::mutex mu;
+    std::condition_variable cv;
+    int running;
+    bool closed;
+  };
+  std::shared_ptr<State> state = std::make_shared<State>();
+  state->next = 0;
+  state->running = 0;
+  state->closed = false;
+
+  auto drain = [&fn, count](State *shared) {
+    int i;
+    while ((i = shared->next.fetch_add(1)) < count) {
+      fn(i);
+    }
+  };
+
+  for(int t=1;t<maxThreads;t++) {
+    Submit([state, drain]() {
+      {
+        std::lock_guard<std::mutex> lock(state->mu);
+        if (state->closed) {
+          // Too late to help; fn may be gone already:
+          return;
+        }
+        state->running++;
+      }
+      drain(state.get());
+      std::lock_guard<std::mutex> lock(state->mu);
+      if (--state->running == 0 && state->closed) {
+        state->cv.notify_all();
+      }
+    });
+  }
+
+  // The caller works too, which also guarantees progress if every pool
+  // thread is busy:
+  drain(state.get());
+
+  std::unique_lock<std::mutex> lock(state->mu);
+  state->closed = true;
+  state->cv.wait(lock, [&] { return state->running == 0; });
+}
+
+// The process-wide pool and the mutex guarding its creation.  Neither
+// is ever deleted: a forked child's copy of the parent pool has no live
+// threads to join, and the pool otherwise lives until exit.
+static std::mutex *poolMu = new std::mutex();
+static WorkerPool *pool = 0;
+
+// Runs in a forked child, which has only the forking thread: the
+// inherited pool's threads are gone, and poolMu may have been held by
+// one of the parent's other threads, so locking it could deadlock.
+// Both are abandoned and the child starts afresh:
+static void
+ResetPoolInChild() {
+  poolMu = new std::mutex();
+  pool = 0;
+}
+
+static int registeredAtFork = pthread_atfork(0, 0, ResetPoolInChild);
+
+WorkerPool *GetWorkerPool() {
+  std::lock_guard<std::mutex> lock(*poolMu);
+  if (pool == 0) {
+    int numThreads = (int) std::thread::hardware_concurrency();
+    if (numThreads < 1) {
+      numThreads = 1;
+    }
+    pool = new WorkerPool(numThreads);
+  }
+  return pool;
+}
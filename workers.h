@@ -0,0 +1,61 @@
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PYCLD_WORKERS_H_
+#define PYCLD_WORKERS_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of native threads.  Tasks never touch Python, so
+// callers must release the GIL before waiting on them.
+class WorkerPool {
+ public:
+  explicit WorkerPool(int numThreads);
+  ~WorkerPool();
+
+  // Queues one task; it runs on some pool thread.
+  void Submit(std::function<void()> task);
+
+  // Calls fn(i) for every i in [0, count), spread across at most
+  // maxThreads threads (the calling thread is one of them; 0 means use
+  // the whole pool), and returns once every call has finished.  It does
+  // not wait for helpers still queued behind other tasks once the
+  // calling thread has run out of indices; they find nothing left to do.
+  void ParallelFor(int count, int maxThreads, const std::function<void(int)> &fn);
+
+  int size() const {
+    return (int) threads.size();
+  }
+
+ private:
+  void Run();
+
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()> > tasks;
+  std::mutex mu;
+  std::condition_variable cv;
+  bool stopping;
+};
+
+// Process-wide pool, created on first use with one thread per CPU.  A
+// forked child gets a fresh pool, since the parent's threads do not
+// survive fork().
+WorkerPool *GetWorkerPool();
+
+#endif  // PYCLD_WORKERS_H_